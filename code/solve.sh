@@ -24,9 +24,14 @@ cat "$GAMEMAP" | tee "$LOGDIR/map.txt"
 echo ''
 
 set +e
-PROG=`cat "$GAMEMAP" | PAIV_TIMEOUT="$TIMEOUT" timeout -2 "$TIMEOUT" "$TARGET_DIR/lifter" 2> "$LOGDIR/stderr.log" `
+PROG=`cat "$GAMEMAP" | PAIV_TIMEOUT="$TIMEOUT" PAIV_CHECKPOINT="$LOGDIR/checkpoint.txt" PAIV_CHECKPOINT_FD=3 \
+    timeout -k 5 -s INT "$TIMEOUT" "$TARGET_DIR/lifter" 2> "$LOGDIR/stderr.log" 3> "$LOGDIR/progress.log" `
 set -e
 
+if [ -z "$PROG" ] && [ -f "$LOGDIR/checkpoint.txt" ]; then
+    PROG=`cut -d' ' -f3 "$LOGDIR/checkpoint.txt"`
+fi
+
 # exec 3< <(cat "$GAMEMAP" | "$TARGET_DIR/lifter" 2> "$LOGDIR/stderr.log")
 # pid=$!
 # echo "pid: $pid"
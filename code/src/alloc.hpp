@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <unordered_set>
+#include <vector>
+
+
+namespace paiv {
+
+using namespace std;
+
+
+// per-thread free lists for the few block sizes a run keeps asking for, memo entries above all.
+// Blocks come from the global heap one by one, so a block freed on another thread
+// simply joins that thread's list.
+typedef struct slab_cache {
+    static constexpr size_t classes = 8;
+    static constexpr size_t cache_bytes = 64 * 1024 * 1024;
+    static constexpr size_t cache_min_blocks = 16;
+
+    typedef struct size_class {
+        size_t size;
+        size_t count;
+        void* head;
+    } size_class;
+
+    size_class slabs[classes];
+
+    // zero-initialized, so thread_local access needs no guard
+    static slab_cache& local() {
+        static thread_local slab_cache cache;
+        return cache;
+    }
+
+    static size_t block_size(const size_t size) {
+        return max(size, sizeof(void*));
+    }
+
+    void* allocate(const size_t size) {
+        for (auto& x : slabs) {
+            if (x.size == size && x.head != nullptr) {
+                auto p = x.head;
+                x.head = *static_cast<void**>(p);
+                x.count--;
+                return p;
+            }
+        }
+        return ::operator new(block_size(size));
+    }
+
+    void deallocate(void* p, const size_t size) {
+        assert(!_recently_freed(size, p));
+
+        size_class* spare = nullptr;
+
+        for (auto& x : slabs) {
+            if (x.size == size) {
+                if (x.count < max(size_t(cache_min_blocks), cache_bytes / size)) {
+                    _push(x, p);
+                }
+                else {
+                    ::operator delete(p);
+                }
+                return;
+            }
+            if (spare == nullptr && x.head == nullptr) {
+                spare = &x;
+            }
+        }
+
+        if (spare != nullptr) {
+            _reaper();
+            spare->size = size;
+            _push(*spare, p);
+            return;
+        }
+
+        ::operator delete(p);
+    }
+
+    void release() {
+        for (auto& x : slabs) {
+            while (x.head != nullptr) {
+                auto p = x.head;
+                x.head = *static_cast<void**>(p);
+                ::operator delete(p);
+            }
+            x.count = 0;
+        }
+    }
+
+private:
+    static constexpr size_t double_free_window = 64;
+
+    // debug check against the blocks most recently put back on the list for this size
+    bool _recently_freed(const size_t size, const void* p) const {
+        for (auto& x : slabs) {
+            if (x.size == size) {
+                auto q = x.head;
+                for (size_t i = 0; q != nullptr && i < double_free_window; i++) {
+                    if (q == p) {
+                        return true;
+                    }
+                    q = *static_cast<void* const*>(q);
+                }
+            }
+        }
+        return false;
+    }
+
+    static void _push(size_class& x, void* p) {
+        *static_cast<void**>(p) = x.head;
+        x.head = p;
+        x.count++;
+    }
+
+    // frees this thread's lists at thread exit, set up the first time a list is claimed
+    static void _reaper() {
+        typedef struct reaper {
+            ~reaper() {
+                local().release();
+            }
+        } reaper;
+        static thread_local reaper r;
+        (void)r;
+    }
+} slab_cache;
+
+
+template<typename T>
+struct slab_allocator {
+    typedef T value_type;
+
+    slab_allocator() {
+    }
+
+    template<typename U>
+    slab_allocator(const slab_allocator<U>&) {
+    }
+
+    T* allocate(const size_t n) {
+        return static_cast<T*>(slab_cache::local().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, const size_t n) {
+        slab_cache::local().deallocate(p, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator == (const slab_allocator<T>&, const slab_allocator<U>&) {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator != (const slab_allocator<T>&, const slab_allocator<U>&) {
+    return false;
+}
+
+
+// bump allocation for containers that live as long as one search, freed all at once
+class arena {
+    static constexpr size_t chunk_size = 256 * 1024;
+
+    vector<unique_ptr<char[]>> chunks;
+    char* head;
+    size_t left;
+
+public:
+    arena() : head(nullptr), left(0) {
+    }
+
+    arena(const arena&) = delete;
+    arena& operator = (const arena&) = delete;
+
+    void* allocate(const size_t size, const size_t align) {
+        auto skip = (align - reinterpret_cast<size_t>(head) % align) % align;
+
+        if (head == nullptr || skip + size > left) {
+            auto bytes = max(size_t(chunk_size), size + align);
+            chunks.emplace_back(new char[bytes]);
+            head = chunks.back().get();
+            left = bytes;
+            skip = (align - reinterpret_cast<size_t>(head) % align) % align;
+        }
+
+        auto p = head + skip;
+        head += skip + size;
+        left -= skip + size;
+        return p;
+    }
+
+    void release() {
+        chunks.clear();
+        head = nullptr;
+        left = 0;
+    }
+};
+
+
+template<typename T>
+struct arena_allocator {
+    typedef T value_type;
+
+    arena* owner;
+
+    arena_allocator(arena& owner) : owner(&owner) {
+    }
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U>& other) : owner(other.owner) {
+    }
+
+    T* allocate(const size_t n) {
+        return static_cast<T*>(owner->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, const size_t) {
+    }
+};
+
+template<typename T, typename U>
+bool operator == (const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.owner == b.owner;
+}
+
+template<typename T, typename U>
+bool operator != (const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.owner != b.owner;
+}
+
+
+template<typename T>
+using arena_set = unordered_set<T, hash<T>, equal_to<T>, arena_allocator<T>>;
+
+
+}
@@ -13,6 +13,23 @@ namespace astar {
 using namespace std;
 
 
+template<typename Location>
+vector<Location>
+_rebuild_path(const Location& goal, const unordered_map<Location, Location>& parent) {
+    forward_list<Location> path;
+    auto loc = goal;
+    while (1) {
+        path.push_front(loc);
+        auto it = parent.find(loc);
+        if (it == end(parent)) {
+            break;
+        }
+        loc = it->second;
+    }
+    return vector<Location>(begin(path), end(path));
+}
+
+
 template<typename Graph,
     typename Location = typename Graph::Location,
     typename Distance = typename Graph::Distance>
@@ -23,9 +40,7 @@ public:
     }
 
     vector<Location>
-    operator () (const Location& from, const Location& goal, const r64 timelimit) {
-        auto started = appclock::now();
-
+    operator () (const Location& from, const Location& goal, const deadline_t& deadline) {
         unordered_map<Location, Distance> distance;
         unordered_map<Location, Location> parent;
         // unordered_set<Location> visited;
@@ -45,10 +60,7 @@ public:
         fringe.push({from, 0});
 
         while (!fringe.empty()) {
-            auto now = appclock::now();
-            chrono::duration<r64> elapsed = now - started;
-            auto timeleft = timelimit - elapsed.count();
-            if (timeleft <= 0) {
+            if (deadline.poll()) {
                 break;
             }
 
@@ -56,7 +68,7 @@ public:
             fringe.pop();
 
             if (graph.check_goal(current.location, goal)) {
-                return _rebuild_path(current.location, parent);
+                return _rebuild_path<Location>(current.location, parent);
             }
 
             // visited.insert(current.location);
@@ -81,21 +93,78 @@ public:
 
         return {};
     }
+};
+
+
+// same search, but the fringe holds (parent, move) pairs costed from the parent,
+// and a child is only simulated once it comes off the fringe
+template<typename Graph,
+    typename Location = typename Graph::Location,
+    typename Move = typename Graph::Move,
+    typename Distance = typename Graph::Distance>
+class lazy_search {
+    Graph& graph;
+public:
+    lazy_search(Graph& graph) : graph(graph) {
+    }
 
-private:
     vector<Location>
-    _rebuild_path(const Location& goal, const unordered_map<Location, Location>& parent) const {
-        forward_list<Location> path;
-        auto loc = goal;
-        while (1) {
-            path.push_front(loc);
-            auto it = parent.find(loc);
-            if (it == end(parent)) {
+    operator () (const Location& from, const deadline_t& deadline) {
+        unordered_map<Location, Location> parent;
+
+        typedef struct entry {
+            Location parent;
+            Move move;
+            Distance distance;
+            Distance cost;
+        } entry;
+
+        static const auto cost_comp = [](const entry& a, const entry& b) {
+            return a.cost > b.cost;
+        };
+
+        priority_queue<entry, vector<entry>, decltype(cost_comp)>
+        fringe(cost_comp);
+
+        vector<Move> moves;
+
+        auto expand = [&](const Location& at, const Distance dist) {
+            graph.moves(at, moves);
+            for (auto mv : moves) {
+                auto next = dist + graph.move_distance(at, mv);
+                fringe.push({at, mv, next, next + graph.move_estimate(at, mv)});
+            }
+        };
+
+        if (graph.check_goal(from)) {
+            return {from};
+        }
+
+        expand(from, 0);
+
+        while (!fringe.empty()) {
+            if (deadline.poll()) {
                 break;
             }
-            loc = it->second;
+
+            auto current = fringe.top();
+            fringe.pop();
+
+            Location child;
+            if (!graph.make(current.parent, current.move, child)) {
+                continue;
+            }
+
+            parent[child] = current.parent;
+
+            if (graph.check_goal(child)) {
+                return _rebuild_path<Location>(child, parent);
+            }
+
+            expand(child, current.distance);
         }
-        return vector<Location>(begin(path), end(path));
+
+        return {};
     }
 };
 
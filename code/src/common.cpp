@@ -1,3 +1,5 @@
+#include <array>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <limits>
@@ -51,12 +53,18 @@ _fill_random(u64vec& table) {
     }
 }
 
+// seeded once per thread instead of on every draw
+static inline mt19937&
+_thread_rng() {
+    thread_local mt19937 gen(_rngeesus());
+    return gen;
+}
+
 template<typename Iter>
 Iter
 random_choice(Iter begin, Iter end) {
-    mt19937 gen(_rngeesus());
     uniform_int_distribution<> distr(0, distance(begin, end) - 1);
-    advance(begin, distr(gen));
+    advance(begin, distr(_thread_rng()));
     return begin;
 }
 
@@ -158,14 +166,64 @@ typedef struct map_info {
 } map_info;
 
 
-typedef struct sim_state {
-    board_t board;
+template<typename Board>
+struct basic_sim_state {
+    Board board;
     u64 board_hash;
     pos robot_pos;
     s32 score;
     u32 lambdas_collected;
     u8 is_ended;
-} sim_state;
+};
+
+typedef basic_sim_state<board_t> sim_state;
+
+
+// board stored inline, for maps of up to N cells; copies move only the cells in use
+template<size_t N>
+struct fixed_board {
+    coosq count;
+    array<cell, N> cells;
+
+    fixed_board() : count(0) {
+    }
+
+    explicit fixed_board(const board_t& board) : count(board.size()) {
+        memcpy(cells.data(), board.data(), count);
+    }
+
+    fixed_board(const fixed_board& other) : count(other.count) {
+        memcpy(cells.data(), other.cells.data(), count);
+    }
+
+    fixed_board& operator = (const fixed_board& other) {
+        count = other.count;
+        memcpy(cells.data(), other.cells.data(), count);
+        return *this;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    cell& operator [] (const size_t offset) {
+        return cells[offset];
+    }
+
+    const cell& operator [] (const size_t offset) const {
+        return cells[offset];
+    }
+
+    board_t to_board() const {
+        return board_t(cells.data(), cells.data() + count);
+    }
+};
+
+template<size_t N>
+using fixed_sim_state = basic_sim_state<fixed_board<N>>;
+
+static constexpr size_t small_board_cells = 32 * 32;
+static constexpr size_t inline_board_cells = 64 * 64;
 
 
 typedef tuple<map_info, sim_state> game_state;
@@ -455,47 +513,74 @@ _update_hash_on_change(u64 value, coosq source, cell s, cell t) {
 }
 
 
+typedef struct undo_t {
+    vector<pair<coosq, cell>> cells;
+    pos robot_pos;
+    u64 board_hash;
+    s32 score;
+    u32 lambdas_collected;
+    u8 is_ended;
+} undo_t;
+
+
+template<typename Board>
 void static inline
-move_entity(board_t& board, u64& board_hash, coord stride, coord from_x, coord from_y, coord to_x, coord to_y) {
+move_entity(Board& board, u64& board_hash, coord stride, coord from_x, coord from_y, coord to_x, coord to_y,
+    undo_t* undo = nullptr) {
+
     coosq source = from_y * stride + from_x;
     coosq target = to_y * stride + to_x;
 
     auto t = board[target];
     auto s = board[source];
+
+    if (undo != nullptr) {
+        undo->cells.push_back(make_pair(target, t));
+        undo->cells.push_back(make_pair(source, s));
+    }
+
     board[target] = s;
     board[source] = cell::empty;
 
     board_hash = _update_hash_on_move(board_hash, source, s, target, t, cell::empty);
 }
 
+template<typename State>
 void static inline
-move_entity(sim_state& state, coord stride, const pos& from, const pos& to) {
-    move_entity(state.board, state.board_hash, stride, from.x, from.y, to.x, to.y);
+move_entity(State& state, coord stride, const pos& from, const pos& to, undo_t* undo = nullptr) {
+    move_entity(state.board, state.board_hash, stride, from.x, from.y, to.x, to.y, undo);
 }
 
 
+template<typename State>
 void static inline
-move_robot(const map_info& map, sim_state& state, const pos& from, const pos& to) {
-    move_entity(state, map.width, from, to);
+move_robot(const map_info& map, State& state, const pos& from, const pos& to, undo_t* undo = nullptr) {
+    move_entity(state, map.width, from, to, undo);
     state.robot_pos = to;
 }
 
 
+template<typename Board>
 void static inline
-move_rock(board_t& board, u64& board_hash, coord stride,
+move_rock(Board& board, u64& board_hash, coord stride,
     coord from_x, coord from_y, coord to_x, coord to_y,
-    const pos& robot_pos, u8* robot_destroyed) {
+    const pos& robot_pos, u8* robot_destroyed, undo_t* undo = nullptr, vector<u8>* landed = nullptr) {
 
-    move_entity(board, board_hash, stride, from_x, from_y, to_x, to_y);
+    move_entity(board, board_hash, stride, from_x, from_y, to_x, to_y, undo);
 
     if (to_x == robot_pos.x && to_y + 1 == robot_pos.y) {
         *robot_destroyed = 1;
     }
+
+    if (landed != nullptr && size_t((to_y + 1) * stride + to_x) < landed->size()) {
+        (*landed)[(to_y + 1) * stride + to_x] = 1;
+    }
 }
 
 
+template<typename State>
 void static inline
-open_lift(sim_state& state, const map_info& map) {
+open_lift(State& state, const map_info& map, undo_t* undo = nullptr) {
     auto& board = state.board;
     const auto& lift = map.lift_pos;
     coosq source = lift.y * map.width + lift.x;
@@ -503,6 +588,10 @@ open_lift(sim_state& state, const map_info& map) {
     auto s = board[source];
 
     if (s == cell::lift) {
+        if (undo != nullptr) {
+            undo->cells.push_back(make_pair(source, s));
+        }
+
         board[source] = cell::openlift;
 
         state.board_hash = _update_hash_on_change(state.board_hash, source, s, cell::openlift);
@@ -510,16 +599,85 @@ open_lift(sim_state& state, const map_info& map) {
 }
 
 
+// one turn of falling and sliding rocks, updated in place from the bottom row up.
+// landed marks the cell under every rock that moved, where a robot gets crushed.
+template<typename Board>
+void static
+update_rocks(const map_info& map, Board& board, u64& board_hash, const pos& robot_pos,
+    u8* robot_destroyed, undo_t* undo = nullptr, vector<u8>* landed = nullptr) {
+
+    coord stride = map.width;
+
+    for (s32 row = map.height - 2; row >= 0; row--) {
+        for (s32 col = 0; col < map.width; col++) {
+            if (board[row * stride + col] == cell::rock) {
+                auto bottom = board[(row+1) * stride + col];
+                switch (bottom) {
+
+                    case cell::empty:
+                        move_rock(board, board_hash, stride, col, row, col, row + 1, robot_pos, robot_destroyed, undo, landed);
+                        break;
+
+                    case cell::rock:
+                        if (col + 1 < map.width && board[row * stride + (col+1)] == cell::empty
+                            && board[(row+1) * stride + (col+1)] == cell::empty) {
+                                move_rock(board, board_hash, stride, col, row, col + 1, row + 1, robot_pos, robot_destroyed, undo, landed);
+                        }
+                        else if (col - 1 >= 0 && board[row * stride + (col-1)] == cell::empty
+                            && board[(row+1) * stride + (col-1)] == cell::empty) {
+                                move_rock(board, board_hash, stride, col, row, col - 1, row + 1, robot_pos, robot_destroyed, undo, landed);
+                        }
+                        break;
+
+                    case cell::lambda:
+                        if (col + 1 < map.width && board[row * stride + (col+1)] == cell::empty
+                            && board[(row+1) * stride + (col+1)] == cell::empty) {
+                                move_rock(board, board_hash, stride, col, row, col + 1, row + 1, robot_pos, robot_destroyed, undo, landed);
+                        }
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+}
+
+
 typedef void (*simcb_t) (const map_info&, const sim_state&);
 
 
-sim_state static
-simulator_step(const map_info& map, const sim_state& currentState, action mv, simcb_t callback = nullptr) {
-    auto state = currentState;
-    auto current_pos = currentState.robot_pos;
+void static inline
+_notify(simcb_t callback, const map_info& map, const sim_state& state) {
+    if (callback != nullptr) {
+        callback(map, state);
+    }
+}
+
+// callbacks only observe the vector-backed engine
+template<typename State>
+void static inline
+_notify(simcb_t, const map_info&, const State&) {
+}
+
+
+template<typename State>
+void static
+simulator_make(const map_info& map, State& state, action mv, undo_t* undo = nullptr, simcb_t callback = nullptr) {
+    auto current_pos = state.robot_pos;
     auto next_pos = advance_pos(current_pos, mv);
     coord stride = map.width;
 
+    if (undo != nullptr) {
+        undo->cells.clear();
+        undo->robot_pos = state.robot_pos;
+        undo->board_hash = state.board_hash;
+        undo->score = state.score;
+        undo->lambdas_collected = state.lambdas_collected;
+        undo->is_ended = state.is_ended;
+    }
+
     switch (mv) {
 
         case action::left:
@@ -535,18 +693,18 @@ simulator_step(const map_info& map, const sim_state& currentState, action mv, si
                     case cell::lambda:
                         state.lambdas_collected++;
                         state.score += 50;
-                        move_robot(map, state, current_pos, next_pos);
+                        move_robot(map, state, current_pos, next_pos, undo);
                         break;
 
                     case cell::openlift:
                         state.is_ended = 1;
                         state.score += 25 * state.lambdas_collected;
-                        move_robot(map, state, current_pos, next_pos);
+                        move_robot(map, state, current_pos, next_pos, undo);
                         break;
 
                     case cell::empty:
                     case cell::earth:
-                        move_robot(map, state, current_pos, next_pos);
+                        move_robot(map, state, current_pos, next_pos, undo);
                         break;
 
                     case cell::rock:
@@ -556,8 +714,8 @@ simulator_step(const map_info& map, const sim_state& currentState, action mv, si
                                     auto rock_pos = advance_pos(next_pos, mv);
                                     if (rock_pos.x >= 0 && rock_pos.x < map.width) {
                                         if (state.board[rock_pos.y * stride + rock_pos.x] == cell::empty) {
-                                            move_entity(state, stride, next_pos, rock_pos);
-                                            move_robot(map, state, current_pos, next_pos);
+                                            move_entity(state, stride, next_pos, rock_pos, undo);
+                                            move_robot(map, state, current_pos, next_pos, undo);
                                         }
                                     }
                                 }
@@ -586,50 +744,15 @@ simulator_step(const map_info& map, const sim_state& currentState, action mv, si
             break;
     }
 
-    if (callback != nullptr) {
-        callback(map, state);
-    }
+    _notify(callback, map, state);
 
     if (state.lambdas_collected >= map.lambdas_total) {
-        open_lift(state, map);
+        open_lift(state, map, undo);
     }
 
     u8 robot_destroyed = 0;
 
-    for (s32 row = map.height - 2; row >= 0; row--) {
-        for (s32 col = 0; col < map.width; col++) {
-            if (state.board[row * stride + col] == cell::rock) {
-                auto bottom = state.board[(row+1) * stride + col];
-                switch (bottom) {
-
-                    case cell::empty:
-                        move_rock(state.board, state.board_hash, stride, col, row, col, row + 1, state.robot_pos, &robot_destroyed);
-                        break;
-
-                    case cell::rock:
-                        if (col + 1 < map.width && state.board[row * stride + (col+1)] == cell::empty
-                            && state.board[(row+1) * stride + (col+1)] == cell::empty) {
-                                move_rock(state.board, state.board_hash, stride, col, row, col + 1, row + 1, state.robot_pos, &robot_destroyed);
-                        }
-                        else if (col - 1 >= 0 && state.board[row * stride + (col-1)] == cell::empty
-                            && state.board[(row+1) * stride + (col-1)] == cell::empty) {
-                                move_rock(state.board, state.board_hash, stride, col, row, col - 1, row + 1, state.robot_pos, &robot_destroyed);
-                        }
-                        break;
-
-                    case cell::lambda:
-                        if (col + 1 < map.width && state.board[row * stride + (col+1)] == cell::empty
-                            && state.board[(row+1) * stride + (col+1)] == cell::empty) {
-                                move_rock(state.board, state.board_hash, stride, col, row, col + 1, row + 1, state.robot_pos, &robot_destroyed);
-                        }
-                        break;
-
-                    default:
-                        break;
-                }
-            }
-        }
-    }
+    update_rocks(map, state.board, state.board_hash, state.robot_pos, &robot_destroyed, undo);
 
     #if 0
     #include <cassert>
@@ -647,10 +770,30 @@ simulator_step(const map_info& map, const sim_state& currentState, action mv, si
         state.score -= 25 * state.lambdas_collected;
     }
 
-    if (callback != nullptr) {
-        callback(map, state);
+    _notify(callback, map, state);
+}
+
+
+template<typename State>
+void static
+simulator_unmake(State& state, const undo_t& undo) {
+    for (auto it = undo.cells.rbegin(); it != undo.cells.rend(); it++) {
+        state.board[it->first] = it->second;
     }
 
+    state.robot_pos = undo.robot_pos;
+    state.board_hash = undo.board_hash;
+    state.score = undo.score;
+    state.lambdas_collected = undo.lambdas_collected;
+    state.is_ended = undo.is_ended;
+}
+
+
+template<typename State>
+State static
+simulator_step(const map_info& map, const State& currentState, action mv, simcb_t callback = nullptr) {
+    auto state = currentState;
+    simulator_make(map, state, mv, nullptr, callback);
     return state;
 }
 
@@ -661,36 +804,76 @@ enum class runsim_opts {
 };
 
 
-sim_state static
-runsim(const map_info& map, const sim_state& currentState, const program_t& prog,
-    runsim_opts opts = runsim_opts::force_abort, simcb_t callback = nullptr) {
-
+template<typename State>
+State static
+_runsim(const map_info& map, const State& currentState, const program_t& prog, runsim_opts opts, simcb_t callback) {
     auto state = currentState;
     coosq turns = 0;
     coosq max_turns = map.width * map.height;
 
-    if (callback != nullptr) {
-        callback(map, state);
-    }
+    _notify(callback, map, state);
 
     for (auto mv : prog) {
         if (state.is_ended || turns >= max_turns) {
             break;
         }
 
-        state = simulator_step(map, state, mv, callback);
+        simulator_make(map, state, mv, nullptr, callback);
 
         turns++;
     }
 
     if (!state.is_ended && opts == runsim_opts::force_abort) {
-        state = simulator_step(map, state, action::abort, callback);
+        simulator_make(map, state, action::abort, nullptr, callback);
     }
 
     return state;
 }
 
 
+template<size_t N>
+sim_state static
+_runsim_fixed(const map_info& map, const sim_state& currentState, const program_t& prog, runsim_opts opts) {
+    fixed_sim_state<N> initial = {
+        fixed_board<N>(currentState.board),
+        currentState.board_hash,
+        currentState.robot_pos,
+        currentState.score,
+        currentState.lambdas_collected,
+        currentState.is_ended,
+    };
+
+    auto state = _runsim(map, initial, prog, opts, nullptr);
+
+    return {
+        state.board.to_board(),
+        state.board_hash,
+        state.robot_pos,
+        state.score,
+        state.lambdas_collected,
+        state.is_ended,
+    };
+}
+
+
+// maps that fit an inline board are replayed on a stack copy, only the final board goes back to the heap
+sim_state static
+runsim(const map_info& map, const sim_state& currentState, const program_t& prog,
+    runsim_opts opts = runsim_opts::force_abort, simcb_t callback = nullptr) {
+
+    auto cells = size_t(map.width * map.height);
+
+    if (callback == nullptr && cells <= small_board_cells) {
+        return _runsim_fixed<small_board_cells>(map, currentState, prog, opts);
+    }
+    if (callback == nullptr && cells <= inline_board_cells) {
+        return _runsim_fixed<inline_board_cells>(map, currentState, prog, opts);
+    }
+
+    return _runsim(map, currentState, prog, opts, callback);
+}
+
+
 sim_state static inline
 runsim(const map_info& map, const sim_state& currentState, const program_t& prog, simcb_t callback) {
     return runsim(map, currentState, prog, runsim_opts::force_abort, callback);
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+
+namespace paiv {
+namespace idastar {
+
+using namespace std;
+
+
+typedef struct tt_entry {
+    u64 hash;
+    u32 depth;
+    u32 iteration;
+} tt_entry;
+
+
+class transposition_table {
+    vector<tt_entry> entries;
+    u64 mask;
+public:
+    transposition_table(const size_t memory) {
+        size_t size = 1;
+        while (size * 2 * sizeof(tt_entry) <= memory) {
+            size *= 2;
+        }
+        entries.resize(size);
+        mask = size - 1;
+    }
+
+    // true if the position was already reached this iteration at the same or lower depth
+    u8 probe_store(const u64 hash, const u32 depth, const u32 iteration) {
+        auto& x = entries[hash & mask];
+        if (x.hash == hash && x.iteration == iteration && x.depth <= depth) {
+            return 1;
+        }
+        x = {hash, depth, iteration};
+        return 0;
+    }
+};
+
+
+template<typename Graph,
+    typename Move = typename Graph::Move,
+    typename Distance = typename Graph::Distance>
+class search {
+    static constexpr Distance found = -1;
+    static constexpr Distance aborted = -2;
+    static constexpr Distance unbounded = numeric_limits<Distance>::max();
+
+    Graph& graph;
+    transposition_table table;
+    deque<vector<Move>> moves;
+    vector<Move> path;
+    u32 iteration;
+
+public:
+    search(Graph& graph, const size_t memory) : graph(graph), table(memory), iteration(0) {
+    }
+
+    vector<Move>
+    operator () (const deadline_t& deadline) {
+        auto bound = graph.estimate();
+
+        while (!deadline.expired()) {
+            iteration++;
+            path.clear();
+
+            auto res = _dfs(0, bound, deadline);
+
+            if (res == found) {
+                return path;
+            }
+            if (res == aborted || res == unbounded) {
+                break;
+            }
+
+            bound = res;
+        }
+
+        return {};
+    }
+
+private:
+    Distance
+    _dfs(const u32 depth, const Distance bound, const deadline_t& deadline) {
+        Distance f = Distance(depth) + graph.estimate();
+        if (f > bound) {
+            return f;
+        }
+
+        if (graph.check_goal()) {
+            return found;
+        }
+
+        if (deadline.poll()) {
+            return aborted;
+        }
+
+        if (table.probe_store(graph.hash(), depth, iteration)) {
+            return unbounded;
+        }
+
+        if (moves.size() <= depth) {
+            moves.resize(depth + 1);
+        }
+
+        graph.moves(moves[depth]);
+
+        Distance next = unbounded;
+
+        for (auto mv : moves[depth]) {
+            if (!graph.make(mv, depth)) {
+                continue;
+            }
+
+            path.push_back(mv);
+
+            auto res = _dfs(depth + 1, bound, deadline);
+            if (res == found) {
+                return found;
+            }
+
+            path.pop_back();
+            graph.unmake(depth);
+
+            if (res == aborted) {
+                return aborted;
+            }
+
+            next = min(next, res);
+        }
+
+        return next;
+    }
+};
+
+
+}
+}
@@ -231,5 +231,7 @@ int main(int argc, char* argv[]) {
     }
 
 
+    paiv::checkpoint.open(getenv("PAIV_CHECKPOINT"), getenv("PAIV_CHECKPOINT_FD"));
+
     return paiv::solve(cin, cout, timelimit - 0.5, cancelled);
 }
@@ -1,5 +1,10 @@
+#include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <unistd.h>
 
 
 #define VERBOSE 1
@@ -18,6 +23,503 @@ static nullstream logger;
 #endif
 
 
+static constexpr u32 deadline_poll_interval = 64;
+
+
+// one deadline is polled from several threads at once. The cached state is relaxed atomics,
+// which compile to plain loads and stores; a lost tick only delays the next clock read.
+struct deadline_t {
+    const u8& cancelled;
+    appclock::time_point until;
+    mutable atomic<u32> ticks;
+    mutable atomic<u8> passed;
+
+    deadline_t(const u8& cancelled, const r64 timelimit) :
+        cancelled(cancelled), until(appclock::now() + _duration(timelimit)), ticks(0), passed(0) {
+    }
+
+    deadline_t(const deadline_t& other) :
+        cancelled(other.cancelled), until(other.until), ticks(0), passed(other._passed()) {
+    }
+
+    deadline_t slice(const r64 timelimit) const {
+        deadline_t res(cancelled, timelimit);
+        res.until = min(res.until, until);
+        res.passed.store(_passed(), memory_order_relaxed);
+        return res;
+    }
+
+    u8 expired() const {
+        if (cancelled || _passed()) {
+            return 1;
+        }
+        u8 res = appclock::now() >= until;
+        passed.store(res, memory_order_relaxed);
+        return res;
+    }
+
+    u8 poll() const {
+        if (cancelled || _passed()) {
+            return 1;
+        }
+        auto tick = ticks.load(memory_order_relaxed);
+        ticks.store(tick + 1, memory_order_relaxed);
+        if (tick % deadline_poll_interval == 0) {
+            u8 res = appclock::now() >= until;
+            passed.store(res, memory_order_relaxed);
+            return res;
+        }
+        return 0;
+    }
+
+    r64 timeleft() const {
+        if (cancelled || _passed()) {
+            return 0;
+        }
+        chrono::duration<r64> left = until - appclock::now();
+        return max(left.count(), 0.0);
+    }
+
+private:
+    u8 _passed() const {
+        return passed.load(memory_order_relaxed);
+    }
+
+    static appclock::duration _duration(const r64 seconds) {
+        return chrono::duration_cast<appclock::duration>(chrono::duration<r64>(max(seconds, 0.0)));
+    }
+};
+
+
+static constexpr r64 checkpoint_interval = 0.25;
+
+
+struct checkpoint_t {
+    string path;
+    int fd;
+    appclock::time_point started;
+    appclock::time_point flushed;
+    atomic<s32> best_score;     // read without the lock to turn away most offers early
+    program_t best_prog;
+    u8 pending;
+    mutex lock;
+
+    checkpoint_t() : fd(-1), started(appclock::now()), best_score(s32_min), pending(0) {
+    }
+
+    void open(const char* file, const char* fdnum) {
+        if (file != nullptr) {
+            path = file;
+        }
+        if (fdnum != nullptr) {
+            fd = stoi(fdnum);
+        }
+    }
+
+    u8 enabled() const {
+        return !path.empty() || fd >= 0;
+    }
+
+    // searches started from a state the robot cannot reach, like a teleport into a room,
+    // hold their programs back until they are replayed from the real start
+    static u8& muted() {
+        static thread_local u8 depth = 0;
+        return depth;
+    }
+
+    void offer(const program_t& prog, const s32 score) {
+        if (!enabled() || muted() || score <= best_score.load(memory_order_relaxed)) {
+            return;
+        }
+
+        lock_guard<mutex> guard(lock);
+
+        if (score <= best_score.load(memory_order_relaxed)) {
+            return;
+        }
+
+        best_score.store(score, memory_order_relaxed);
+        best_prog = prog;
+        pending = 1;
+
+        chrono::duration<r64> elapsed = appclock::now() - flushed;
+        if (elapsed.count() >= checkpoint_interval) {
+            _flush();
+        }
+    }
+
+    void flush() {
+        if (!enabled()) {
+            return;
+        }
+
+        lock_guard<mutex> guard(lock);
+        _flush();
+    }
+
+private:
+    void _flush() {
+        if (!pending) {
+            return;
+        }
+
+        auto now = appclock::now();
+        chrono::duration<r64> elapsed = now - started;
+
+        stringstream so;
+        so << fixed << setprecision(3) << elapsed.count() << ' ' << best_score.load(memory_order_relaxed) << ' ' << best_prog << '\n';
+        auto line = so.str();
+
+        if (!path.empty()) {
+            auto tmp = path + ".tmp";
+            {
+                ofstream fo(tmp, ios::trunc);
+                fo << line;
+            }
+            rename(tmp.c_str(), path.c_str());
+        }
+
+        if (fd >= 0) {
+            if (write(fd, line.data(), line.size()) < 0) {
+                fd = -1;
+            }
+        }
+
+        flushed = now;
+        pending = 0;
+    }
+};
+
+
+static checkpoint_t checkpoint;
+
+
+typedef struct checkpoint_mute {
+    checkpoint_mute() {
+        checkpoint_t::muted()++;
+    }
+
+    ~checkpoint_mute() {
+        checkpoint_t::muted()--;
+    }
+} checkpoint_mute;
+
+
+enum frozen_bits : u8 {
+    frozen_below = 1 << 0,
+    frozen_below_rock = 1 << 1,
+    frozen_left = 1 << 2,
+    frozen_right = 1 << 3,
+    frozen_downleft = 1 << 4,
+    frozen_downright = 1 << 5,
+};
+
+
+vector<u8> static
+_frozen_rock_table() {
+    vector<u8> table(64);
+
+    for (u8 code = 0; code < table.size(); code++) {
+        u8 supported = (code & frozen_below) != 0;
+        u8 pinned = (code & (frozen_left | frozen_right)) != 0;
+        u8 slides_right = !(code & (frozen_right | frozen_downright));
+        u8 slides_left = !(code & (frozen_left | frozen_downleft));
+        u8 slides = (code & frozen_below_rock) && (slides_right || slides_left);
+
+        table[code] = supported && pinned && !slides;
+    }
+
+    return table;
+}
+
+// rock neighbourhoods (frozen_bits) in which the rock can never move again
+static const vector<u8> frozen_rock_table = _frozen_rock_table();
+
+
+vector<u8> static
+frozen_rocks(const map_info& map, const board_t& board) {
+    vector<u8> frozen(board.size(), 0);
+
+    auto permanent = [&] (coord col, coord row) -> u8 {
+        if (col < 0 || col >= map.width || row < 0 || row >= map.height) {
+            return 1;
+        }
+        coosq offset = row * map.width + col;
+        switch (board[offset]) {
+            case cell::wall:
+            case cell::lift:
+            case cell::openlift:
+                return 1;
+            case cell::rock:
+                return frozen[offset];
+            default:
+                return 0;
+        }
+    };
+
+    for (u8 changed = 1; changed; ) {
+        changed = 0;
+
+        for (coord row = map.height - 1; row >= 0; row--) {
+            for (coord col = 0; col < map.width; col++) {
+                coosq offset = row * map.width + col;
+
+                if (board[offset] != cell::rock || frozen[offset]) {
+                    continue;
+                }
+
+                u8 below = permanent(col, row + 1);
+                u8 code =
+                    (below ? frozen_below : 0) |
+                    (below && row + 1 < map.height && board[offset + map.width] == cell::rock ? frozen_below_rock : 0) |
+                    (permanent(col - 1, row) ? frozen_left : 0) |
+                    (permanent(col + 1, row) ? frozen_right : 0) |
+                    (permanent(col - 1, row + 1) ? frozen_downleft : 0) |
+                    (permanent(col + 1, row + 1) ? frozen_downright : 0);
+
+                if (frozen_rock_table[code]) {
+                    frozen[offset] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    return frozen;
+}
+
+
+static constexpr u32 unreachable = numeric_limits<u32>::max();
+
+
+// optimistic move counts: rocks that can still move are treated as passable
+vector<u32> static
+flood_distances(const map_info& map, const board_t& board, const vector<u8>& frozen, const pos& start) {
+    vector<u32> distance(board.size(), unreachable);
+    vector<coosq> fringe;
+
+    coosq origin = start.y * map.width + start.x;
+    fringe.push_back(origin);
+    distance[origin] = 0;
+
+    static const pos neighbours[] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+    for (size_t i = 0; i < fringe.size(); i++) {
+        auto offset = fringe[i];
+        coord col = offset % map.width;
+        coord row = offset / map.width;
+
+        for (auto& d : neighbours) {
+            coord x = col + d.x;
+            coord y = row + d.y;
+
+            if (x < 0 || x >= map.width || y < 0 || y >= map.height) {
+                continue;
+            }
+
+            coosq next = y * map.width + x;
+            if (distance[next] != unreachable) {
+                continue;
+            }
+
+            switch (board[next]) {
+                case cell::lift:
+                case cell::openlift:
+                    distance[next] = distance[offset] + 1;
+                    break;
+
+                case cell::rock:
+                    if (frozen[next]) {
+                        break;
+                    }
+                    distance[next] = distance[offset] + 1;
+                    fringe.push_back(next);
+                    break;
+
+                case cell::empty:
+                case cell::earth:
+                case cell::lambda:
+                case cell::robot:
+                    distance[next] = distance[offset] + 1;
+                    fringe.push_back(next);
+                    break;
+
+                case cell::none:
+                case cell::wall:
+                    break;
+            }
+        }
+    }
+
+    return distance;
+}
+
+
+typedef struct reach_info {
+    vector<u32> distance;
+    u32 lambdas_left;
+    u32 lambdas_reachable;
+    u8 lift_reachable;
+
+    u8 reachable(const coosq offset) const {
+        return distance[offset] != unreachable;
+    }
+
+    u8 is_unwinnable() const {
+        return !lift_reachable || lambdas_reachable < lambdas_left;
+    }
+
+    u8 is_dead() const {
+        return !lift_reachable && lambdas_reachable == 0;
+    }
+} reach_info;
+
+
+reach_info static
+analyse_reach(const map_info& map, const sim_state& sim, const vector<u8>& frozen) {
+    const auto& board = sim.board;
+
+    reach_info info = {vector<u32>(board.size(), unreachable), 0, 0, 0};
+
+    if (!sim.is_ended) {
+        info.distance = flood_distances(map, board, frozen, sim.robot_pos);
+    }
+
+    for (coosq offset = 0; offset < board.size(); offset++) {
+        switch (board[offset]) {
+            case cell::lambda:
+                info.lambdas_left++;
+                info.lambdas_reachable += info.reachable(offset);
+                break;
+            case cell::lift:
+            case cell::openlift:
+                info.lift_reachable = info.reachable(offset);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return info;
+}
+
+
+reach_info static inline
+analyse_reach(const map_info& map, const sim_state& sim) {
+    return analyse_reach(map, sim, frozen_rocks(map, sim.board));
+}
+
+
+u8 static inline
+is_reachable(const map_info& map, const sim_state& sim, const pos& goal) {
+    return analyse_reach(map, sim).reachable(goal.y * map.width + goal.x);
+}
+
+
+// no program continuing from sim can score more than this
+s32 static
+score_bound(const map_info& map, const sim_state& sim) {
+    if (sim.is_ended) {
+        return sim.score;
+    }
+
+    const auto& board = sim.board;
+    auto frozen = frozen_rocks(map, board);
+    auto reach = analyse_reach(map, sim, frozen);
+
+    s32 lambdas = reach.lambdas_reachable;
+    u32 farthest = 0;
+
+    for (coosq offset = 0; offset < board.size(); offset++) {
+        if (board[offset] == cell::lambda && reach.reachable(offset)) {
+            farthest = max(farthest, reach.distance[offset]);
+        }
+    }
+
+    s32 bound = sim.score + 50 * lambdas - max(s32(farthest), lambdas);
+
+    if (!reach.is_unwinnable()) {
+        auto to_lift = flood_distances(map, board, frozen, map.lift_pos);
+        u32 tour = reach.distance[map.lift_pos.y * map.width + map.lift_pos.x];
+
+        for (coosq offset = 0; offset < board.size(); offset++) {
+            if (board[offset] == cell::lambda) {
+                tour = max(tour, reach.distance[offset] + to_lift[offset]);
+            }
+        }
+
+        s32 collected = sim.lambdas_collected + lambdas;
+        bound = max(bound, sim.score + 50 * lambdas + 25 * collected - max(s32(tour), lambdas + 1));
+    }
+
+    return max(bound, sim.score);
+}
+
+
+u8 static inline
+rocks_moved(const undo_t& undo) {
+    for (auto& x : undo.cells) {
+        if (x.second == cell::rock) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// cells the robot must not step onto this turn. Rocks are updated with the robot
+// lifted off the board, which matches every step onto earth, empty or a lambda.
+vector<u8> static
+danger_map(const map_info& map, const sim_state& sim) {
+    auto board = sim.board;
+    u64 hash = 0;
+    u8 destroyed = 0;
+    vector<u8> res(board.size(), 0);
+
+    board[sim.robot_pos.y * map.width + sim.robot_pos.x] = cell::empty;
+    update_rocks(map, board, hash, sim.robot_pos, &destroyed, nullptr, &res);
+
+    return res;
+}
+
+
+// a rock resting right above the target stays put once the robot is below it,
+// pushes and waits are left to the simulator
+u8 static inline
+is_lethal_step(const map_info& map, const sim_state& sim, const vector<u8>& danger, const action mv) {
+    switch (mv) {
+        case action::left:
+        case action::right:
+        case action::up:
+        case action::down:
+            break;
+        default:
+            return 0;
+    }
+
+    auto target = advance_pos(sim.robot_pos, mv);
+    if (target.x < 0 || target.x >= map.width || target.y <= 0 || target.y >= map.height) {
+        return 0;
+    }
+
+    auto offset = target.y * map.width + target.x;
+
+    switch (sim.board[offset]) {
+        case cell::empty:
+        case cell::earth:
+        case cell::lambda:
+            break;
+        default:
+            return 0;
+    }
+
+    return danger[offset] && sim.board[offset - map.width] != cell::rock;
+}
+
+
+static constexpr u32 dead_check_interval = 16;
+
+
 static constexpr action all_actions[] = {
     action::left,
     action::right,
@@ -28,113 +530,387 @@ static constexpr action all_actions[] = {
 };
 
 
+typedef u8 action_mask;     // bit i stands for all_actions[i]
+
+
+u8 static inline
+action_rank(const action mv) {
+    for (u8 i = 0; i < array_len(all_actions); i++) {
+        if (all_actions[i] == mv) {
+            return i;
+        }
+    }
+    return array_len(all_actions);
+}
+
+
+action_mask static inline
+action_bit(const action mv) {
+    return action_mask(1) << action_rank(mv);
+}
+
+
+static constexpr u8 enterable_cell[] = {
+    1,  // none
+    1,  // empty
+    1,  // earth
+    0,  // wall
+    0,  // rock
+    1,  // lambda
+    0,  // lift
+    1,  // openlift
+    0,  // robot
+};
+
+
+// legal actions as a mask over all_actions, read straight from the robot's neighbourhood
+action_mask static inline
+legal_mask(const map_info& map, const sim_state& sim, const size_t depth, const action_mask exclude = 0) {
+    if (sim.is_ended || depth >= size_t(map.width * map.height)) {
+        return 0;
+    }
+
+    const auto& board = sim.board;
+    auto x = sim.robot_pos.x;
+    auto y = sim.robot_pos.y;
+
+    auto at = [&] (const coord col, const coord row) {
+        return (col >= 0 && col < map.width && row >= 0 && row < map.height) ? board[row * map.width + col] : cell::wall;
+    };
+
+    auto left = at(x - 1, y);
+    auto right = at(x + 1, y);
+
+    action_mask res = action_bit(action::wait);
+    res |= (enterable_cell[u8(left)] | (left == cell::rock && at(x - 2, y) == cell::empty)) << action_rank(action::left);
+    res |= (enterable_cell[u8(right)] | (right == cell::rock && at(x + 2, y) == cell::empty)) << action_rank(action::right);
+    res |= enterable_cell[u8(at(x, y - 1))] << action_rank(action::up);
+    res |= enterable_cell[u8(at(x, y + 1))] << action_rank(action::down);
+
+    return res & ~exclude;
+}
+
+
 vector<action> static inline
-legal_moves(const map_info& map, const sim_state& sim, const program_t& prog, const u8set& exclude = {}) {
+legal_moves(const map_info& map, const sim_state& sim, const program_t& prog, const u8set& exclude = {},
+    const u8 prune_dead = 0, const u8 prune_lethal = 0) {
 
-    if (sim.is_ended) {
-        return {};
+    action_mask excluded = 0;
+    for (auto x : exclude) {
+        excluded |= action_bit(action(x));
     }
 
-    if (prog.size() >= map.width * map.height) {
+    auto mask = legal_mask(map, sim, prog.size(), excluded);
+
+    if (mask == 0 || (prune_dead && analyse_reach(map, sim).is_dead())) {
         return {};
     }
 
+    vector<u8> danger;
+    if (prune_lethal) {
+        danger = danger_map(map, sim);
+    }
+
     vector<action> res;
+
+    for (; mask != 0; mask &= mask - 1) {
+        auto mv = all_actions[__builtin_ctz(mask)];
+        if (!prune_lethal || !is_lethal_step(map, sim, danger, mv)) {
+            res.push_back(mv);
+        }
+    }
+
+    return res;
+}
+
+
+static constexpr coord commute_margin = 2;
+
+
+// true if playing a then b gives the same state as b then a. Only orthogonal
+// steps through empty cells with no rock close enough to react in two turns.
+u8 static inline
+moves_commute(const map_info& map, const sim_state& sim, const action a, const action b) {
+    auto horizontal = [] (const action mv) { return mv == action::left || mv == action::right; };
+    auto vertical = [] (const action mv) { return mv == action::up || mv == action::down; };
+
+    if (!(horizontal(a) && vertical(b)) && !(vertical(a) && horizontal(b))) {
+        return 0;
+    }
+
+    auto inside = [&map] (const pos& p) {
+        return p.x >= 0 && p.x < map.width && p.y >= 0 && p.y < map.height;
+    };
+
+    const auto& board = sim.board;
     auto stride = map.width;
+    auto at = [&] (const pos& p) { return board[p.y * stride + p.x]; };
 
-    for (auto mv : all_actions) {
-        if (exclude.find(mv) != end(exclude)) continue;
+    auto p = sim.robot_pos;
+    auto pa = advance_pos(p, a);
+    auto pb = advance_pos(p, b);
+    auto pab = advance_pos(pa, b);
 
-        u8 is_valid = 1;
+    if (!inside(pa) || !inside(pb) || !inside(pab)) {
+        return 0;
+    }
 
-        switch (mv) {
+    if (at(pa) != cell::empty || at(pb) != cell::empty) {
+        return 0;
+    }
 
-            case action::left:
-            case action::right:
-            case action::up:
-            case action::down: {
-                    auto& current_pos = sim.robot_pos;
-                    auto next_pos = advance_pos(current_pos, mv);
+    switch (at(pab)) {
+        case cell::empty:
+        case cell::earth:
+        case cell::lambda:
+        case cell::openlift:
+            break;
+        default:
+            return 0;
+    }
 
-                    u8 inside_bounds = next_pos.x >= 0 && next_pos.x < map.width && next_pos.y >= 0 && next_pos.y < map.height;
-                    if (!inside_bounds) {
-                        is_valid = 0;
-                    }
-                    else {
-                        auto target = sim.board[next_pos.y * stride + next_pos.x];
-                        switch (target) {
-                            case cell::none:
-                            case cell::empty:
-                            case cell::earth:
-                            case cell::lambda:
-                            case cell::openlift:
-                                break;
-
-                            case cell::rock:
-                                switch (mv) {
-                                    case action::left:
-                                    case action::right: {
-                                            auto rock_pos = advance_pos(next_pos, mv);
-                                            is_valid = rock_pos.x >= 0 && rock_pos.x < map.width;
-                                            if (is_valid)
-                                                is_valid = sim.board[rock_pos.y * stride + rock_pos.x] == cell::empty;
-                                        }
-                                        break;
-                                    default:
-                                        is_valid = 0;
-                                        break;
-                                }
-                                break;
-
-                            case cell::wall:
-                            case cell::lift:
-                            case cell::robot:
-                                is_valid = 0;
-                                break;
-                        }
-                    }
-                }
-                break;
+    coord x0 = max(0, min(p.x, pab.x) - commute_margin);
+    coord x1 = min(map.width - 1, max(p.x, pab.x) + commute_margin);
+    coord y0 = max(0, min(p.y, pab.y) - commute_margin - 1);
+    coord y1 = min(map.height - 1, max(p.y, pab.y) + 1);
 
-            case action::wait:
-            case action::abort:
-                break;
+    for (coord row = y0; row <= y1; row++) {
+        for (coord col = x0; col <= x1; col++) {
+            if (board[row * stride + col] == cell::rock) {
+                return 0;
+            }
         }
+    }
 
-        if (is_valid) {
-            res.push_back(mv);
-        }
+    return 1;
+}
+
+
+// of two commuting moves only the lower-ranked one may come first
+u8 static inline
+is_canonical(const map_info& map, const sim_state& parent, const action last, const action mv) {
+    return action_rank(last) <= action_rank(mv) || !moves_commute(map, parent, last, mv);
+}
+
+
+// one draw from the thread's generator, picking the k-th set bit
+action static inline
+random_action(const action_mask mask) {
+    if (mask == 0) {
+        return action::abort;
     }
 
-    return res;
+    auto m = mask;
+    for (auto k = _thread_rng()() % __builtin_popcount(mask); k > 0; k--) {
+        m &= m - 1;
+    }
+
+    return all_actions[__builtin_ctz(m)];
 }
 
 
 action static inline
-random_move(const map_info& map, const sim_state& sim, const program_t& prog, const u8set& exclude = {}) {
-    auto moves = legal_moves(map, sim, prog, exclude);
-    if (moves.size() > 0) {
-        return *random_choice(begin(moves), end(moves));
+random_move(const map_info& map, const sim_state& sim, const program_t& prog, const action_mask exclude = 0,
+    const u8 prune_dead = 0) {
+    auto mask = legal_mask(map, sim, prog.size(), exclude);
+    if (mask != 0 && prune_dead && analyse_reach(map, sim).is_dead()) {
+        return action::abort;
     }
-    return action::abort;
+    return random_action(mask);
 }
 
+
+typedef u32 node_id;
+
+static constexpr node_id no_node = numeric_limits<node_id>::max();
+
+
+// monte carlo search tree in columns, addressed by 32-bit node ids. Children hang off
+// first_child through next_sibling links, and siblings created together sit side by side,
+// so the selection loop reads visits and means from contiguous memory.
+// Payload carries what each player keeps per node; the moves leading to a node are
+// recovered by walking its parents.
+template<typename Payload>
+struct uct_tree {
+    static constexpr size_t node_bytes = 3 * sizeof(node_id) + sizeof(u64) + 2 * sizeof(u8) +
+        sizeof(u32) + sizeof(float) + sizeof(Payload);
+
+    vector<node_id> parent;
+    vector<node_id> first_child;
+    vector<node_id> next_sibling;
+    vector<u64> board_hash;
+    vector<u8> explored;
+    vector<u8> expanded;
+    vector<u32> visits;
+    vector<float> mean;
+    vector<Payload> payload;
+
+    vector<node_id> spare;
+    unordered_map<u64, node_id> visited;
+    size_t limit;
+
+    explicit uct_tree(const size_t budget) : limit(max(size_t(1), budget / node_bytes)) {
+    }
+
+    size_t size() const {
+        return visits.size() - spare.size();
+    }
+
+    size_t capacity() const {
+        return limit;
+    }
+
+    // links a new last child under from, or returns no_node once the budget is spent
+    node_id add(const node_id from, const u64 hash, const Payload& data) {
+        if (size() >= limit) {
+            return no_node;
+        }
+
+        node_id id = visits.size();
+
+        if (!spare.empty()) {
+            id = spare.back();
+            spare.pop_back();
+            parent[id] = from;
+            first_child[id] = no_node;
+            next_sibling[id] = no_node;
+            board_hash[id] = hash;
+            explored[id] = 0;
+            expanded[id] = 0;
+            visits[id] = 0;
+            mean[id] = 0;
+            payload[id] = data;
+        }
+        else {
+            parent.push_back(from);
+            first_child.push_back(no_node);
+            next_sibling.push_back(no_node);
+            board_hash.push_back(hash);
+            explored.push_back(0);
+            expanded.push_back(0);
+            visits.push_back(0);
+            mean.push_back(0);
+            payload.push_back(data);
+        }
+
+        if (from != no_node) {
+            auto* link = &first_child[from];
+            while (*link != no_node) {
+                link = &next_sibling[*link];
+            }
+            *link = id;
+        }
+
+        visited[hash] = id;
+
+        return id;
+    }
+
+    void backprop(node_id n, const r64 score) {
+        for (; n != no_node; n = parent[n]) {
+            visits[n]++;
+            mean[n] += (score - mean[n]) / visits[n];
+        }
+    }
+
+    // turns n back into an unexpanded leaf, returning its descendants to the spare list
+    void prune(const node_id n) {
+        vector<node_id> dropped;
+
+        for (auto c = first_child[n]; c != no_node; c = next_sibling[c]) {
+            dropped.push_back(c);
+        }
+
+        first_child[n] = no_node;
+        expanded[n] = 0;
+        explored[n] = 0;
+
+        while (!dropped.empty()) {
+            auto x = dropped.back();
+            dropped.pop_back();
+
+            for (auto c = first_child[x]; c != no_node; c = next_sibling[c]) {
+                dropped.push_back(c);
+            }
+
+            auto it = visited.find(board_hash[x]);
+            if (it != end(visited) && it->second == x) {
+                visited.erase(it);
+            }
+
+            payload[x] = Payload();
+            spare.push_back(x);
+        }
+    }
+
+    // drop the subtrees under the least visited nodes until a quarter of the budget is spare.
+    // Their roots keep their statistics and are expanded again if selection comes back to them.
+    void collect(const node_id root) {
+        auto wanted = limit - limit / 4;
+
+        for (u32 threshold = 1; size() > wanted && threshold < visits[root]; threshold *= 2) {
+            vector<node_id> stack = {root};
+
+            while (!stack.empty()) {
+                auto n = stack.back();
+                stack.pop_back();
+
+                for (auto c = first_child[n]; c != no_node; c = next_sibling[c]) {
+                    if (first_child[c] == no_node) {
+                        continue;
+                    }
+                    if (visits[c] > threshold) {
+                        stack.push_back(c);
+                    }
+                    else {
+                        prune(c);
+                    }
+                }
+            }
+        }
+    }
+};
+
 }
 
 
 // #include "solver_bfs.cpp"
 // #include "solver_mc.cpp"
 #include "solver_pl.cpp"
+#include "solver_regions.cpp"
+#include "solver_nested.cpp"
+#include "solver_genetic.cpp"
+#include "solver_opt.cpp"
 
 namespace paiv {
 
+static constexpr r64 post_time_share = 0.1;
+static constexpr r64 post_time_max = 0.5;
+// measured on the sample maps: any share from 0.1 to 0.5 beats annealing only in leftover time
+static constexpr r64 anneal_time_share = 0.25;
+
+
 s32 static
 solve(istream& si, ostream& so, const r64 timelimit, const u8& cancelled) {
+    deadline_t deadline(cancelled, timelimit);
+    auto post_time = min(post_time_max, timelimit * post_time_share);
+    auto anneal_deadline = deadline.slice(timelimit - post_time);
+    auto search_deadline = deadline.slice((timelimit - post_time) * (1 - anneal_time_share));
+
     auto game = read_map(si);
 
-    // program_t prog = bfs::player(game, timelimit, cancelled);
-    // program_t prog = mc::player(game, timelimit, cancelled);
-    program_t prog = pl::player(game, timelimit, cancelled);
+    // program_t prog = bfs::player(game, search_deadline);
+    // program_t prog = mc::player(game, search_deadline);
+    // program_t prog = nested::player(game, search_deadline);
+    // program_t prog = genetic::player(game, search_deadline);
+    // program_t prog = pl::player(game, search_deadline);
+    program_t prog = regions::player(game, search_deadline);
+
+    prog = opt::anneal(getmap(game), getsim(game), prog, anneal_deadline);
+    prog = opt::optimize(getmap(game), getsim(game), prog, deadline);
+
+    checkpoint.offer(prog, runsim(getmap(game), getsim(game), prog).score);
+    checkpoint.flush();
 
     so << prog;
 
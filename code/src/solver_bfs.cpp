@@ -14,10 +14,14 @@ typedef struct search_state {
 
 
 vector<search_state> static inline
-children(const map_info& map, const search_state& currentState) {
+children(const map_info& map, const search_state& currentState, const sim_state* parent = nullptr) {
     vector<search_state> res;
 
     for (auto mv : legal_moves(map, currentState.sim, currentState.prog)) {
+        if (parent != nullptr && !is_canonical(map, *parent, currentState.prog.back(), mv)) {
+            continue;
+        }
+
         auto state = currentState;
         state.prog.push_back(mv);
         res.push_back(state);
@@ -28,7 +32,7 @@ children(const map_info& map, const search_state& currentState) {
 
 
 search_state static
-player(const map_info& map, const search_state& initialState, const u8& cancelled) {
+player(const map_info& map, const search_state& initialState, const deadline_t& deadline) {
 
     auto best = initialState;
     // size_t depth = 0;
@@ -38,11 +42,13 @@ player(const map_info& map, const search_state& initialState, const u8& cancelle
 
     fringe.push(initialState);
 
-    while (fringe.size() > 0 && !cancelled) {
+    while (fringe.size() > 0 && !deadline.poll()) {
         auto current = fringe.front();
         fringe.pop();
 
 
+        auto parent = current.sim;
+
         if (current.prog.size() > 0) {
             current.sim = simulator_step(map, current.sim, current.prog.back());
             current.is_win = current.sim.is_ended && current.sim.robot_pos == map.lift_pos;
@@ -64,9 +70,14 @@ player(const map_info& map, const search_state& initialState, const u8& cancelle
 
         if (current.sim.score > best.sim.score) {
             best = current;
+            checkpoint.offer(best.prog, best.sim.score);
+        }
+
+        if (score_bound(map, current.sim) <= best.sim.score) {
+            continue;
         }
 
-        for (auto& child : children(map, current)) {
+        for (auto& child : children(map, current, current.prog.empty() ? nullptr : &parent)) {
             fringe.push(child);
         }
     }
@@ -82,7 +93,7 @@ player(const map_info& map, const search_state& initialState, const u8& cancelle
 
 
 program_t static inline
-player(const game_state& game, const r64 timelimit, const u8& cancelled) {
+player(const game_state& game, const deadline_t& deadline) {
 
     auto& map = getmap(game);
     auto& sim = getsim(game);
@@ -93,7 +104,7 @@ player(const game_state& game, const r64 timelimit, const u8& cancelled) {
         program_t(),
     };
 
-    state = player(map, state, cancelled);
+    state = player(map, state, deadline);
 
     return state.prog;
 }
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace paiv {
+namespace genetic {
+
+
+using pl::search_state;
+using pl::time_budget;
+
+
+static constexpr u32 action_bits = 3;
+static constexpr u32 actions_per_word = 64 / action_bits;
+static constexpr size_t elite_size = 256;
+static constexpr size_t generation_size = 1024;
+static constexpr r64 seed_time_share = 0.25;
+static constexpr size_t seed_dives = 16;
+static constexpr u32 tournament_size = 4;
+static constexpr r64 mutation_rate = 0.2;
+
+
+static constexpr action action_codes[] = {
+    action::left,
+    action::right,
+    action::up,
+    action::down,
+    action::wait,
+    action::abort,
+};
+
+
+u64 static inline
+action_code(const action mv) {
+    switch (mv) {
+        case action::left: return 0;
+        case action::right: return 1;
+        case action::up: return 2;
+        case action::down: return 3;
+        case action::wait: return 4;
+        case action::abort: return 5;
+    }
+    return 5;
+}
+
+
+// 21 moves per u64, so an elite of a few hundred programs stays within a few pages
+struct packed_program {
+    vector<u64> words;
+    u32 count;
+
+    packed_program() : count(0) {
+    }
+
+    packed_program(const program_t& prog) : count(0) {
+        words.reserve((prog.size() + actions_per_word - 1) / actions_per_word);
+        for (auto mv : prog) {
+            push_back(mv);
+        }
+    }
+
+    u32 size() const {
+        return count;
+    }
+
+    void push_back(const action mv) {
+        auto shift = (count % actions_per_word) * action_bits;
+        if (shift == 0) {
+            words.push_back(0);
+        }
+        words.back() |= action_code(mv) << shift;
+        count++;
+    }
+
+    action operator [] (const u32 index) const {
+        auto shift = (index % actions_per_word) * action_bits;
+        return action_codes[(words[index / actions_per_word] >> shift) & 7];
+    }
+
+    program_t unpack() const {
+        program_t prog;
+        prog.reserve(count);
+        for (u32 i = 0; i < count; i++) {
+            prog.push_back((*this)[i]);
+        }
+        return prog;
+    }
+};
+
+
+typedef struct individual {
+    packed_program prog;
+    s32 score;
+    u64 final_hash;
+    u8 evaluated;
+} individual;
+
+
+// 32-bit fingerprint of the board before each played move
+typedef vector<u32> trail_t;
+
+
+template<typename Visit>
+void static
+_play(const map_info& map, const sim_state& initial, const packed_program& prog, Visit visit, sim_state& state) {
+    state = initial;
+    coosq max_turns = map.width * map.height;
+
+    for (u32 i = 0; i < prog.size() && i < max_turns && !state.is_ended; i++) {
+        visit(state.board_hash);
+        simulator_make(map, state, prog[i]);
+    }
+
+    if (!state.is_ended) {
+        simulator_make(map, state, action::abort);
+    }
+}
+
+
+void static
+evaluate(const map_info& map, const sim_state& initial, individual& x) {
+    sim_state state;
+    _play(map, initial, x.prog, [] (const u64) {}, state);
+
+    x.score = state.score;
+    x.final_hash = state.board_hash;
+    x.evaluated = 1;
+}
+
+
+// replayed only for the parents picked in the current generation
+trail_t static
+trail(const map_info& map, const sim_state& initial, const packed_program& prog) {
+    trail_t res;
+    res.reserve(prog.size());
+
+    sim_state state;
+    _play(map, initial, prog, [&] (const u64 hash) { res.push_back(u32(hash ^ (hash >> 32))); }, state);
+
+    return res;
+}
+
+
+// splice a and b where both reach the same board, so the tail of b plays out unchanged.
+// A fingerprint collision only yields a different child, which gets scored like any other.
+u8 static
+crossover(const individual& a, const trail_t& ta, const individual& b, const trail_t& tb, mt19937& rng,
+    packed_program& child) {
+
+    unordered_map<u32, u32> positions;
+    for (u32 j = 0; j < tb.size(); j++) {
+        positions.emplace(tb[j], j);
+    }
+
+    vector<pair<u32, u32>> cuts;
+    for (u32 i = 1; i < ta.size(); i++) {
+        auto it = positions.find(ta[i]);
+        if (it != end(positions)) {
+            cuts.push_back(make_pair(i, it->second));
+        }
+    }
+
+    if (cuts.empty()) {
+        return 0;
+    }
+
+    uniform_int_distribution<size_t> distr(0, cuts.size() - 1);
+    auto cut = cuts[distr(rng)];
+
+    child = packed_program();
+    for (u32 i = 0; i < cut.first; i++) {
+        child.push_back(a.prog[i]);
+    }
+    for (u32 j = cut.second; j < b.prog.size(); j++) {
+        child.push_back(b.prog[j]);
+    }
+
+    return 1;
+}
+
+
+packed_program static
+mutate(const map_info& map, const packed_program& prog, mt19937& rng) {
+    auto moves = prog.unpack();
+
+    uniform_int_distribution<size_t> positions(0, moves.size());
+    uniform_int_distribution<size_t> kinds(0, 2);
+    uniform_int_distribution<size_t> codes(0, array_len(all_actions) - 1);
+
+    auto index = positions(rng);
+
+    switch (kinds(rng)) {
+        case 0:
+            moves.insert(begin(moves) + index, all_actions[codes(rng)]);
+            break;
+        case 1:
+            if (index < moves.size()) {
+                moves.erase(begin(moves) + index);
+            }
+            break;
+        default:
+            moves.resize(index);
+            moves.push_back(action::abort);
+            break;
+    }
+
+    if (moves.size() > size_t(map.width * map.height)) {
+        moves.resize(map.width * map.height);
+    }
+
+    return packed_program(moves);
+}
+
+
+size_t static
+tournament(const vector<individual>& pool, mt19937& rng) {
+    uniform_int_distribution<size_t> distr(0, pool.size() - 1);
+    auto best = distr(rng);
+
+    for (u32 i = 1; i < tournament_size; i++) {
+        auto x = distr(rng);
+        if (pool[x].score > pool[best].score) {
+            best = x;
+        }
+    }
+
+    return best;
+}
+
+
+// keep the best programs, one per final board
+void static
+select_elite(vector<individual>& pool) {
+    sort(begin(pool), end(pool), [](const individual& a, const individual& b) {
+        return a.score > b.score || (a.score == b.score && a.prog.size() < b.prog.size());
+    });
+
+    unordered_set<u64> seen;
+    vector<individual> elite;
+
+    for (auto& x : pool) {
+        if (elite.size() >= elite_size) {
+            break;
+        }
+        if (seen.insert(x.final_hash).second) {
+            elite.push_back(move(x));
+        }
+    }
+
+    pool = move(elite);
+}
+
+
+// individuals left when the deadline passes are dropped from the batch
+void static
+evaluate_all(const map_info& map, const sim_state& initial, vector<individual>& batch, const deadline_t& deadline) {
+    size_t workers = max(thread::hardware_concurrency(), 1u);
+    vector<thread> pool;
+
+    for (size_t worker = 0; worker < min(workers, batch.size()); worker++) {
+        auto local = deadline.slice(deadline.timeleft());
+
+        pool.push_back(thread([&, worker, local] () {
+            for (size_t i = worker; i < batch.size() && !local.expired(); i += workers) {
+                evaluate(map, initial, batch[i]);
+            }
+        }));
+    }
+
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    batch.erase(remove_if(begin(batch), end(batch), [] (const individual& x) {
+        return !x.evaluated;
+    }), end(batch));
+}
+
+
+search_state static inline
+player_genetic(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
+
+    mt19937 rng(_rngeesus());
+    vector<individual> pool;
+
+    auto seed_deadline = deadline.slice(deadline.timeleft() * seed_time_share);
+
+    for (size_t i = 0; i < seed_dives && !seed_deadline.expired(); i++) {
+        auto tm = seed_deadline.timeleft() / (seed_dives - i);
+        auto state = pl::player_rand(map, initialState, seed_deadline.slice(tm), budget);
+        pool.push_back({packed_program(state.prog), 0, 0, 0});
+    }
+
+    evaluate_all(map, initialState.sim, pool, deadline);
+    select_elite(pool);
+
+    u64 generations = 0;
+
+    while (!pool.empty() && !deadline.expired()) {
+        vector<individual> batch;
+        batch.reserve(generation_size);
+
+        uniform_real_distribution<r64> chance(0, 1);
+        unordered_map<size_t, trail_t> trails;
+
+        auto parent_trail = [&] (const size_t index) -> const trail_t& {
+            auto it = trails.find(index);
+            if (it == end(trails)) {
+                it = trails.emplace(index, trail(map, initialState.sim, pool[index].prog)).first;
+            }
+            return it->second;
+        };
+
+        for (size_t i = 0; i < generation_size && !deadline.expired(); i++) {
+            auto ia = tournament(pool, rng);
+            auto ib = tournament(pool, rng);
+            auto& a = pool[ia];
+            auto& b = pool[ib];
+
+            packed_program child;
+            if (!crossover(a, parent_trail(ia), b, parent_trail(ib), rng, child)) {
+                child = a.prog;
+            }
+
+            if (chance(rng) < mutation_rate) {
+                child = mutate(map, child, rng);
+            }
+
+            batch.push_back({move(child), 0, 0, 0});
+        }
+
+        trails.clear();
+        evaluate_all(map, initialState.sim, batch, deadline);
+
+        pool.insert(end(pool), make_move_iterator(begin(batch)), make_move_iterator(end(batch)));
+        select_elite(pool);
+
+        checkpoint.offer(pool.front().prog.unpack(), pool.front().score);
+        generations++;
+    }
+
+    logger << "generations: " << generations << endl;
+
+    auto best = initialState;
+
+    if (!pool.empty()) {
+        best.prog = pool.front().prog.unpack();
+        best.sim = runsim(map, initialState.sim, best.prog);
+        best.is_win = best.sim.is_ended && best.sim.robot_pos == map.lift_pos;
+    }
+
+    return best;
+}
+
+
+program_t static inline
+player(const game_state& game, const deadline_t& deadline) {
+    auto& map = getmap(game);
+    auto& sim = getsim(game);
+
+    search_state state = {
+        sim,
+        sim.robot_pos == map.lift_pos,
+        program_t(),
+    };
+
+    time_budget budget(deadline);
+
+    state = player_genetic(map, state, deadline, budget);
+
+    return state.prog;
+}
+
+
+} // namespace genetic
+}
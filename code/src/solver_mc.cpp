@@ -2,6 +2,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include "alloc.hpp"
 
 
 namespace paiv {
@@ -30,9 +31,9 @@ typedef struct node {
 struct memo_t {
     typedef program_t Key;
     typedef search_state Value;
-    typedef list<pair<Key,Value>> Container;
+    typedef list<pair<Key,Value>, slab_allocator<pair<Key,Value>>> Container;
     typedef Container::const_iterator Iter;
-    typedef unordered_map<Key, Iter> Map;
+    typedef unordered_map<Key, Iter, hash<Key>, equal_to<Key>, slab_allocator<pair<const Key, Iter>>> Map;
 
     static constexpr size_t max_size = 200 * 1024 * 1024 / sizeof(Value);
 
@@ -82,21 +83,29 @@ advance_search(const map_info& map, const search_state& currentState, action mv)
 
 
 search_state static inline
-mc_dive(const map_info& map, const search_state& initialState, const u8& cancelled) {
+mc_dive(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    const s32 incumbent = s32_min) {
+
     auto state = initialState;
 
-    unordered_set<u64> visited;
+    arena dive;
+    arena_set<u64> visited(dive);
     visited.insert(state.sim.board_hash);
 
-    while (!state.sim.is_ended && !cancelled) {
-        u8set exclude;
+    while (!state.sim.is_ended && !deadline.poll()) {
+        action_mask exclude = 0;
+
+        u8 prune = state.prog.size() % dead_check_interval == 0;
 
-        auto mv = random_move(map, state.sim, state.prog);
+        if (prune && score_bound(map, state.sim) <= incumbent) {
+            break;
+        }
+        auto mv = random_move(map, state.sim, state.prog, exclude, prune);
 
         auto nextState = advance_search(map, state, mv);
 
-        while (!nextState.sim.is_ended && visited.find(nextState.sim.board_hash) != end(visited) && !cancelled) {
-            exclude.insert(mv);
+        while (!nextState.sim.is_ended && visited.find(nextState.sim.board_hash) != end(visited) && !deadline.poll()) {
+            exclude |= action_bit(mv);
             mv = random_move(map, state.sim, state.prog, exclude);
             nextState = advance_search(map, state, mv);
         }
@@ -125,9 +134,7 @@ select_heuristic(const node& n) {
 
 
 search_state static inline
-player(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
-    auto started = appclock::now();
-
+player(const map_info& map, const search_state& initialState, const deadline_t& deadline) {
     s32 best_score = initialState.sim.score;
     auto best_state = initialState;
 
@@ -160,15 +167,9 @@ player(const map_info& map, const search_state& initialState, const r64 timelimi
 
     program_t path;
 
-    while (!cancelled) {
+    while (!deadline.expired()) {
         logger << "loop score: " << best_score << ", tree size: " << search_tree.size() << " (max " << tree_max_size << ")"<< endl;
 
-        auto now = appclock::now();
-        chrono::duration<r64> elapsed = now - started;
-        if (elapsed.count() >= timelimit) {
-            break;
-        }
-
         // select
         // logger << "select\n";
         node* selected = &search_tree[0];
@@ -282,12 +283,13 @@ player(const map_info& map, const search_state& initialState, const r64 timelimi
 
             // simulate
             // logger << "simulate\n";
-            auto deep_state = mc_dive(map, selected_state, cancelled);
+            auto deep_state = mc_dive(map, selected_state, deadline, best_score);
             score = deep_state.sim.score;
 
             if (score > best_score) {
                 best_score = score;
                 best_state = deep_state;
+                checkpoint.offer(best_state.prog, best_score);
                 // logger << "best update: " << best_score << " " << best_state.prog << endl;
             }
         }
@@ -325,7 +327,7 @@ player(const map_info& map, const search_state& initialState, const r64 timelimi
 
 
 program_t static inline
-player(const game_state& game, const r64 timelimit, const u8& cancelled, const u32 retries = 1) {
+player(const game_state& game, const deadline_t& deadline, const u32 retries = 1) {
     s32 best_score = s32_min;
     program_t best_prog;
 
@@ -339,7 +341,7 @@ player(const game_state& game, const r64 timelimit, const u8& cancelled, const u
             program_t(),
         };
 
-        state = player(map, state, timelimit / retries, cancelled);
+        state = player(map, state, deadline.slice(deadline.timeleft() / (retries - i)));
 
         if (state.sim.score > best_score) {
             best_score = state.sim.score;
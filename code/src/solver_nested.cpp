@@ -0,0 +1,361 @@
+#include <cmath>
+#include <random>
+#include <unordered_set>
+
+
+namespace paiv {
+namespace nested {
+
+
+using pl::search_state;
+using pl::time_budget;
+
+
+enum class move_kind : u8 {
+    raw = 0,
+    macro = 1,
+};
+
+
+static constexpr u32 policy_bits = 14;
+static constexpr u32 policy_mask = (1u << policy_bits) - 1;
+static constexpr u32 nrpa_iterations = 100;
+static constexpr r64 nrpa_alpha = 1.0;
+
+
+typedef vector<float> policy_t;
+
+
+typedef struct candidate {
+    u32 code;
+    pos goal;
+    action mv;
+} candidate;
+
+
+typedef struct step_t {
+    u32 code;
+    u32 prog_end;
+    vector<u32> candidates;
+} step_t;
+
+
+typedef struct playout_t {
+    search_state state;
+    vector<step_t> line;
+} playout_t;
+
+
+struct context {
+    const map_info& map;
+    const move_kind kind;
+    const deadline_t& deadline;
+    time_budget& budget;
+    mt19937 rng;
+
+    context(const map_info& map, const move_kind kind, const deadline_t& deadline, time_budget& budget) :
+        map(map), kind(kind), deadline(deadline), budget(budget), rng(_rngeesus()) {
+    }
+
+    u8 stopped() const {
+        return kind == move_kind::macro ? deadline.expired() : deadline.poll();
+    }
+};
+
+
+u32 static inline
+move_code(const pos& from, const pos& to, const u32 mv) {
+    u32 h = 2166136261u;
+    for (u32 x : {u32(from.x), u32(from.y), u32(to.x), u32(to.y), mv}) {
+        h = (h ^ x) * 16777619u;
+    }
+    return h & policy_mask;
+}
+
+
+vector<candidate> static
+candidates(context& ctx, const search_state& state) {
+    vector<candidate> res;
+
+    if (state.sim.is_ended) {
+        return res;
+    }
+
+    const auto& from = state.sim.robot_pos;
+
+    switch (ctx.kind) {
+        case move_kind::raw:
+            for (auto mv : legal_moves(ctx.map, state.sim, state.prog)) {
+                res.push_back({move_code(from, from, mv), from, mv});
+            }
+            break;
+
+        case move_kind::macro:
+            for (auto& goal : pl::plan_goals(ctx.map, state)) {
+                res.push_back({move_code(from, goal, 0), goal, action::wait});
+            }
+            break;
+    }
+
+    return res;
+}
+
+
+u8 static
+apply(context& ctx, const search_state& state, const candidate& x, search_state& next) {
+    if (ctx.kind == move_kind::raw) {
+        next = pl::advance_search(ctx.map, state, x.mv);
+        return 1;
+    }
+
+    if (x.goal == state.sim.robot_pos) {
+        next = pl::advance_search(ctx.map, state, action::wait);
+    }
+    else {
+        auto gain = pl::goal_gain(ctx.map, state, x.goal);
+        auto tm = ctx.budget.allot(x.goal, gain, ctx.deadline.timeleft() / 4, gain);
+        next = pl::find_path(ctx.map, state, x.goal, ctx.deadline.slice(tm), ctx.budget);
+    }
+
+    return next.sim.robot_pos == x.goal;
+}
+
+
+search_state static
+follow(context& ctx, const search_state& state, const program_t& prog, const u32 prog_end) {
+    auto next = state;
+
+    for (auto i = state.prog.size(); i < prog_end; i++) {
+        next = pl::advance_search(ctx.map, next, prog[i]);
+    }
+
+    return next;
+}
+
+
+size_t static
+sample(context& ctx, const vector<candidate>& moves, const policy_t* policy) {
+    if (policy == nullptr) {
+        uniform_int_distribution<size_t> distr(0, moves.size() - 1);
+        return distr(ctx.rng);
+    }
+
+    vector<r64> weights;
+    weights.reserve(moves.size());
+
+    for (auto& x : moves) {
+        weights.push_back(exp((*policy)[x.code]));
+    }
+
+    discrete_distribution<size_t> distr(begin(weights), end(weights));
+    return distr(ctx.rng);
+}
+
+
+playout_t static
+rollout(context& ctx, const search_state& initialState, const policy_t* policy) {
+    playout_t res = {initialState, {}};
+    auto& state = res.state;
+
+    unordered_set<u64> visited;
+    visited.insert(state.sim.board_hash);
+
+    while (!state.sim.is_ended && !ctx.stopped()) {
+        auto moves = candidates(ctx, state);
+
+        step_t step = {0, 0, {}};
+        for (auto& x : moves) {
+            step.candidates.push_back(x.code);
+        }
+
+        u8 moved = 0;
+
+        while (!moves.empty() && !moved) {
+            auto i = sample(ctx, moves, policy);
+
+            search_state next;
+            if (apply(ctx, state, moves[i], next) && visited.find(next.sim.board_hash) == end(visited)) {
+                step.code = moves[i].code;
+                step.prog_end = next.prog.size();
+                state = next;
+                visited.insert(state.sim.board_hash);
+                moved = 1;
+            }
+            else {
+                moves.erase(begin(moves) + i);
+            }
+        }
+
+        if (!moved) {
+            break;
+        }
+
+        res.line.push_back(step);
+    }
+
+    return res;
+}
+
+
+playout_t static
+nmcs(context& ctx, const search_state& initialState, const u32 level) {
+    if (level == 0) {
+        return rollout(ctx, initialState, nullptr);
+    }
+
+    // start from a plain rollout, so a level that never improves on it still plays a line
+    auto first = rollout(ctx, initialState, nullptr);
+    auto state = initialState;
+    auto best = move(first.state);
+    vector<step_t> played;
+    vector<step_t> best_tail = move(first.line);
+
+    while (!state.sim.is_ended && !ctx.stopped()) {
+        auto moves = candidates(ctx, state);
+
+        vector<u32> codes;
+        for (auto& x : moves) {
+            codes.push_back(x.code);
+        }
+
+        for (auto& x : moves) {
+            if (ctx.stopped()) {
+                break;
+            }
+
+            search_state next;
+            if (!apply(ctx, state, x, next)) {
+                continue;
+            }
+
+            auto res = nmcs(ctx, next, level - 1);
+
+            if (res.state.sim.score > best.sim.score) {
+                best = res.state;
+                best_tail = {{x.code, u32(next.prog.size()), codes}};
+                best_tail.insert(end(best_tail), begin(res.line), end(res.line));
+            }
+        }
+
+        if (best_tail.empty()) {
+            break;
+        }
+
+        state = follow(ctx, state, best.prog, best_tail.front().prog_end);
+        played.push_back(best_tail.front());
+        best_tail.erase(begin(best_tail));
+    }
+
+    played.insert(end(played), begin(best_tail), end(best_tail));
+
+    return {best, played};
+}
+
+
+void static
+adapt(policy_t& policy, const vector<step_t>& line) {
+    auto next = policy;
+
+    for (auto& step : line) {
+        r64 z = 0;
+        for (auto code : step.candidates) {
+            z += exp(policy[code]);
+        }
+
+        next[step.code] += nrpa_alpha;
+
+        for (auto code : step.candidates) {
+            next[code] -= nrpa_alpha * exp(policy[code]) / z;
+        }
+    }
+
+    policy = move(next);
+}
+
+
+playout_t static
+nrpa(context& ctx, const search_state& initialState, const u32 level, policy_t& policy) {
+    if (level == 0) {
+        return rollout(ctx, initialState, &policy);
+    }
+
+    playout_t best = {initialState, {}};
+
+    for (u32 i = 0; i < nrpa_iterations && !ctx.stopped(); i++) {
+        auto child_policy = policy;
+        auto res = nrpa(ctx, initialState, level - 1, child_policy);
+
+        if (res.state.sim.score >= best.state.sim.score) {
+            best = move(res);
+        }
+
+        adapt(policy, best.line);
+    }
+
+    return best;
+}
+
+
+search_state static inline
+player_nmcs(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget, const move_kind kind = move_kind::macro, const u32 level = 1) {
+
+    context ctx(map, kind, deadline, budget);
+    auto best = initialState;
+
+    while (!deadline.expired()) {
+        auto res = nmcs(ctx, initialState, level);
+
+        if (res.state.sim.score > best.sim.score) {
+            best = res.state;
+            checkpoint.offer(best.prog, best.sim.score);
+        }
+    }
+
+    return best;
+}
+
+
+search_state static inline
+player_nrpa(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget, const move_kind kind = move_kind::macro, const u32 level = 2) {
+
+    context ctx(map, kind, deadline, budget);
+    auto best = initialState;
+
+    while (!deadline.expired()) {
+        policy_t policy(policy_mask + 1);
+        auto res = nrpa(ctx, initialState, level, policy);
+
+        if (res.state.sim.score > best.sim.score) {
+            best = res.state;
+            checkpoint.offer(best.prog, best.sim.score);
+        }
+    }
+
+    return best;
+}
+
+
+program_t static inline
+player(const game_state& game, const deadline_t& deadline) {
+    auto& map = getmap(game);
+    auto& sim = getsim(game);
+
+    search_state state = {
+        sim,
+        sim.robot_pos == map.lift_pos,
+        program_t(),
+    };
+
+    time_budget budget(deadline);
+
+    // state = player_nmcs(map, state, deadline, budget);
+    state = player_nrpa(map, state, deadline, budget);
+
+    return state.prog;
+}
+
+
+} // namespace nested
+}
@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace paiv {
+namespace opt {
+
+
+static constexpr size_t prefix_stride = 16;
+static constexpr u32 window_min_depth = 2;
+static constexpr u32 window_max_depth = 8;
+static constexpr u32 window_span_factor = 4;
+static constexpr u32 anneal_history = 64;
+static constexpr size_t anneal_segment_max = 8;
+static constexpr r64 anneal_path_time = 0.005;
+
+
+struct trajectory {
+    const map_info& map;
+    const sim_state& initial;
+    program_t prog;
+    vector<u64> hashes;         // board before move i, prog.size() + 1 entries
+    vector<s32> scores;
+    vector<u8> ended;
+    vector<sim_state> prefix;   // state before move k * prefix_stride
+
+    trajectory(const map_info& map, const sim_state& initial, const program_t& prog) :
+        map(map), initial(initial), prog(prog) {
+        rebuild(0);
+    }
+
+    size_t size() const {
+        return prog.size();
+    }
+
+    sim_state state_at(const size_t index) const {
+        auto k = min(index / prefix_stride, prefix.size() - 1);
+        auto state = prefix[k];
+        for (auto i = k * prefix_stride; i < index; i++) {
+            simulator_make(map, state, prog[i]);
+        }
+        return state;
+    }
+
+    // re-simulate everything after index, keeping the cached prefix before it
+    void rebuild(const size_t index) {
+        auto from = min(index, hashes.empty() ? 0 : hashes.size() - 1);
+        auto state = from == 0 ? initial : state_at(from);
+
+        hashes.resize(from);
+        scores.resize(from);
+        ended.resize(from);
+        prefix.resize(from == 0 ? 0 : (from - 1) / prefix_stride + 1);
+
+        for (auto i = from; ; i++) {
+            if (i % prefix_stride == 0) {
+                prefix.push_back(state);
+            }
+
+            hashes.push_back(state.board_hash);
+            scores.push_back(state.score);
+            ended.push_back(state.is_ended);
+
+            if (i >= prog.size()) {
+                break;
+            }
+
+            if (state.is_ended) {
+                prog.resize(i);
+                break;
+            }
+
+            simulator_make(map, state, prog[i]);
+        }
+    }
+
+    void splice(const size_t from, const size_t to, const program_t& replacement) {
+        program_t tail(begin(prog) + to, end(prog));
+        prog.resize(from);
+        prog.insert(end(prog), begin(replacement), end(replacement));
+        prog.insert(end(prog), begin(tail), end(tail));
+        rebuild(from);
+    }
+};
+
+
+// cut out every stretch of moves that comes back to an earlier board
+u8 static
+remove_loops(trajectory& path, const deadline_t& deadline) {
+    u8 changed = 0;
+
+    for (u8 found = 1; found && !deadline.expired(); ) {
+        found = 0;
+        unordered_map<u64, size_t> seen;
+
+        for (size_t i = 0; i < path.hashes.size(); i++) {
+            auto it = seen.find(path.hashes[i]);
+
+            if (it != end(seen) && path.ended[it->second] == path.ended[i]) {
+                path.splice(it->second, i, {});
+                found = changed = 1;
+                break;
+            }
+
+            seen[path.hashes[i]] = i;
+        }
+    }
+
+    return changed;
+}
+
+
+struct shortcut_search {
+    const map_info& map;
+    const deadline_t& deadline;
+    const u32 depth;
+    unordered_map<u64, size_t> targets;
+    unordered_map<u64, u32> visited;
+    vector<undo_t> undo;
+    program_t line;
+    program_t best_line;
+    size_t best_target;
+    size_t origin;
+
+    shortcut_search(const map_info& map, const deadline_t& deadline, const u32 depth) :
+        map(map), deadline(deadline), depth(depth), undo(depth), best_target(0), origin(0) {
+    }
+
+    // shortest known way from trajectory index i to a later board of the same trajectory
+    u8 operator () (const trajectory& path, const size_t i) {
+        auto span = min(path.size(), i + window_span_factor * depth);
+
+        targets.clear();
+        for (auto j = i + 1; j <= span; j++) {
+            if (!path.ended[j]) {
+                targets[path.hashes[j]] = j;
+            }
+        }
+
+        if (targets.empty()) {
+            return 0;
+        }
+
+        visited.clear();
+        line.clear();
+        best_line.clear();
+        best_target = 0;
+        origin = i;
+
+        auto state = path.state_at(i);
+        _dfs(state);
+
+        return best_target > 0;
+    }
+
+private:
+    void _dfs(sim_state& state) {
+        auto d = u32(line.size());
+
+        auto it = targets.find(state.board_hash);
+        if (it != end(targets) && it->second > origin + d && !state.is_ended) {
+            auto saving = it->second - origin - d;
+            if (best_target == 0 || saving > best_target - origin - best_line.size()) {
+                best_target = it->second;
+                best_line = line;
+            }
+        }
+
+        if (d >= depth || state.is_ended || deadline.poll()) {
+            return;
+        }
+
+        auto seen = visited.find(state.board_hash);
+        if (seen != end(visited) && seen->second <= d) {
+            return;
+        }
+        visited[state.board_hash] = d;
+
+        for (auto mv : legal_moves(map, state, {})) {
+            simulator_make(map, state, mv, &undo[d]);
+            line.push_back(mv);
+
+            _dfs(state);
+
+            line.pop_back();
+            simulator_unmake(state, undo[d]);
+        }
+    }
+};
+
+
+u8 static
+shortcut_windows(trajectory& path, const deadline_t& deadline, const u32 depth) {
+    shortcut_search search(path.map, deadline, depth);
+    u8 changed = 0;
+
+    for (size_t i = 0; i < path.size() && !deadline.expired(); i++) {
+        if (search(path, i)) {
+            path.splice(i, search.best_target, search.best_line);
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+
+// abort where the score peaks instead of playing on to a worse end
+u8 static
+best_abort(trajectory& path) {
+    size_t best = path.size();
+
+    for (size_t i = 0; i < path.size(); i++) {
+        if (!path.ended[i] && path.scores[i] > path.scores[best]) {
+            best = i;
+        }
+    }
+
+    if (best == path.size()) {
+        return 0;
+    }
+
+    program_t tail = { action::abort };
+    path.splice(best, path.size(), tail);
+    return 1;
+}
+
+
+enum class mutation : u8 {
+    reverse = 0,
+    insert = 1,
+    erase = 2,
+    reroute = 3,
+    count = 4,
+};
+
+
+// final score of prog, which must agree with the trajectory before index
+s32 static
+score_from(const trajectory& path, const size_t index, const program_t& prog) {
+    auto state = path.state_at(index);
+
+    for (auto i = index; i < prog.size() && !state.is_ended; i++) {
+        simulator_make(path.map, state, prog[i]);
+    }
+
+    if (!state.is_ended) {
+        simulator_make(path.map, state, action::abort);
+    }
+
+    return state.score;
+}
+
+
+u8 static
+mutate(const trajectory& path, mt19937& rng, const deadline_t& deadline, pl::time_budget& budget,
+    program_t& prog, size_t& index) {
+
+    uniform_int_distribution<u32> kinds(0, u32(mutation::count) - 1);
+    uniform_int_distribution<size_t> positions(0, path.size());
+    uniform_int_distribution<size_t> spans(1, anneal_segment_max);
+
+    prog = path.prog;
+    index = positions(rng);
+    auto last = min(path.size(), index + spans(rng));
+
+    switch (mutation(kinds(rng))) {
+        case mutation::reverse:
+            if (last - index < 2) {
+                return 0;
+            }
+            reverse(begin(prog) + index, begin(prog) + last);
+            return 1;
+
+        case mutation::insert: {
+                uniform_int_distribution<size_t> moves(0, array_len(all_actions) - 1);
+                prog.insert(begin(prog) + index, all_actions[moves(rng)]);
+            }
+            return 1;
+
+        case mutation::erase:
+            if (last == index) {
+                return 0;
+            }
+            prog.erase(begin(prog) + index, begin(prog) + last);
+            return 1;
+
+        case mutation::reroute: {
+                if (last == index) {
+                    return 0;
+                }
+
+                auto from = path.state_at(index);
+                auto to = from;
+                for (auto i = index; i < last; i++) {
+                    simulator_make(path.map, to, prog[i]);
+                }
+
+                pl::search_state start = {from, 0, {}};
+                auto goal = to.robot_pos;
+                auto found = pl::find_path(path.map, start, goal, deadline.slice(anneal_path_time), budget);
+
+                if (found.sim.robot_pos != goal || found.prog == program_t(begin(prog) + index, begin(prog) + last)) {
+                    return 0;
+                }
+
+                prog.erase(begin(prog) + index, begin(prog) + last);
+                prog.insert(begin(prog) + index, begin(found.prog), end(found.prog));
+            }
+            return 1;
+
+        case mutation::count:
+            break;
+    }
+
+    return 0;
+}
+
+
+// late acceptance hill climbing from one incumbent
+program_t static
+anneal_chain(const map_info& map, const sim_state& initial, const program_t& prog, const deadline_t& deadline,
+    pl::time_budget& budget, const u32 seed) {
+
+    mt19937 rng(seed);
+    trajectory path(map, initial, prog);
+
+    auto current = runsim(map, initial, path.prog).score;
+    auto best = current;
+    auto best_prog = path.prog;
+
+    vector<s32> history(anneal_history, current);
+    program_t candidate;
+    size_t index;
+
+    for (u64 k = 0; !deadline.expired(); k++) {
+        if (!mutate(path, rng, deadline, budget, candidate, index)) {
+            continue;
+        }
+
+        if (candidate.size() > size_t(map.width * map.height)) {
+            continue;
+        }
+
+        auto score = score_from(path, index, candidate);
+        auto& late = history[k % anneal_history];
+
+        if (score >= current || score >= late) {
+            path.prog = move(candidate);
+            path.rebuild(index);
+            current = score;
+
+            if (current > best) {
+                best = current;
+                best_prog = path.prog;
+                checkpoint.offer(best_prog, best);
+            }
+        }
+
+        late = current;
+    }
+
+    return best_prog;
+}
+
+
+program_t static
+anneal(const map_info& map, const sim_state& initial, const program_t& prog, const deadline_t& deadline) {
+    if (deadline.expired()) {
+        return prog;
+    }
+
+    pl::time_budget budget(deadline);
+
+    size_t workers = max(thread::hardware_concurrency(), 1u);
+    vector<program_t> results(workers, prog);
+    vector<thread> pool;
+
+    for (size_t worker = 0; worker < workers; worker++) {
+        auto seed = _rngeesus();
+        pool.push_back(thread([&, worker, seed] () {
+            results[worker] = anneal_chain(map, initial, prog, deadline, budget, seed);
+        }));
+    }
+
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    auto best = prog;
+    auto best_score = runsim(map, initial, prog).score;
+
+    for (auto& x : results) {
+        auto score = runsim(map, initial, x).score;
+        if (score > best_score) {
+            best = x;
+            best_score = score;
+        }
+    }
+
+    logger << "local search: " << runsim(map, initial, prog).score << " -> " << best_score << endl;
+
+    return best;
+}
+
+
+program_t static
+optimize(const map_info& map, const sim_state& initial, const program_t& prog, const deadline_t& deadline) {
+    if (deadline.expired()) {
+        return prog;
+    }
+
+    trajectory path(map, initial, prog);
+
+    remove_loops(path, deadline);
+
+    for (auto depth = window_min_depth; depth <= window_max_depth && !deadline.expired(); depth++) {
+        if (shortcut_windows(path, deadline, depth)) {
+            remove_loops(path, deadline);
+        }
+    }
+
+    best_abort(path);
+
+    auto before = runsim(map, initial, prog).score;
+    auto after = runsim(map, initial, path.prog).score;
+
+    logger << "post-optimizer: " << before << " -> " << after << ", " <<
+        prog.size() << " -> " << path.prog.size() << " moves" << endl;
+
+    return after >= before ? path.prog : prog;
+}
+
+
+} // namespace opt
+}
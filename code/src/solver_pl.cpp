@@ -1,29 +1,419 @@
 #include <algorithm>
+#include <deque>
 #include <forward_list>
 #include <list>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include "alloc.hpp"
 #include "astar.hpp"
+#include "idastar.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 namespace paiv {
 namespace pl {
 
 
+static constexpr coord goal_radius = 3;
+
+
+// cells matching a goal pattern, before the reach filter, computed on the board with board_hash.
+// Moves made since then leave the cells they touched in changed, up to the board with changed_hash,
+// so the next update only revisits the neighbourhood of those cells
+typedef struct goal_set {
+    u64 board_hash = 0;
+    u64 changed_hash = 0;
+    vector<u64> goals;
+    vector<u64> waiting;    // rocks that still move when the robot waits
+    vector<coosq> changed;
+} goal_set;
+
+
 typedef struct search_state {
     sim_state sim;
     u8 is_win;
     program_t prog;
+    goal_set goals;
+
+    search_state() : is_win(0) {
+    }
+
+    search_state(const sim_state& sim, const u8 is_win, const program_t& prog) :
+        sim(sim), is_win(is_win), prog(prog) {
+    }
 } search_state;
 
 
+u8 static inline
+_bit(const vector<u64>& bits, const coosq offset) {
+    return (bits[offset / 64] >> (offset % 64)) & 1;
+}
+
+
+void static inline
+_set_bit(vector<u64>& bits, const coosq offset, const u8 value) {
+    auto mask = u64(1) << (offset % 64);
+    bits[offset / 64] = value ? (bits[offset / 64] | mask) : (bits[offset / 64] & ~mask);
+}
+
+
+u8 static inline
+_goal_pattern(const map_info& map, const board_t& board, const coord col, const coord row) {
+    auto stride = map.width;
+    coosq offset = row * stride + col;
+
+    switch (board[offset]) {
+
+        case cell::lambda:
+        case cell::openlift:
+            return 1;
+
+        case cell::earth: {
+                cell up = row > 0 ? board[offset - stride] : cell::none;
+                cell left = col > 0 ? board[offset - 1] : cell::none;
+                cell upleft = (row > 0 && col > 0) ? board[offset - stride - 1] : cell::none;
+                cell right = col + 1 < map.width ? board[offset + 1] : cell::none;
+                cell left2 = col > 1 ? board[offset - 2] : cell::none;
+                cell left3 = col > 2 ? board[offset - 3] : cell::none;
+                cell right2 = col + 2 < map.width ? board[offset + 2] : cell::none;
+                cell right3 = col + 3 < map.width ? board[offset + 3] : cell::none;
+
+                if (up == cell::rock) {
+                    return 1;
+                }
+                else if (left == cell::rock) {
+                    switch (left2) {
+                        case cell::empty:
+                        case cell::earth:
+                        case cell::lambda:
+                            return 1;
+                        default:
+                            return 0;
+                    }
+                }
+                else if (right == cell::rock) {
+                    switch (right2) {
+                        case cell::empty:
+                        case cell::earth:
+                        case cell::lambda:
+                            return 1;
+                        default:
+                            return 0;
+                    }
+                }
+                else if (left == cell::lambda && upleft == cell::rock) {
+                    return 1;
+                }
+                else if (left == cell::empty && left2 == cell::rock) {
+                    return 1;
+                }
+                else if (left == cell::empty && left2 == cell::empty && left3 == cell::rock) {
+                    return 1;
+                }
+                else if (right == cell::empty && right2 == cell::rock) {
+                    return 1;
+                }
+                else if (right == cell::empty && right2 == cell::empty && right3 == cell::rock) {
+                    return 1;
+                }
+            }
+            return 0;
+
+        case cell::rock: {
+                cell left = col > 0 ? board[offset - 1] : cell::none;
+                cell right = col + 1 < map.width ? board[offset + 1] : cell::none;
+
+                return (left == cell::robot && right == cell::empty) ||
+                    (right == cell::robot && left == cell::empty);
+            }
+
+        default:
+            return 0;
+    }
+}
+
+
+u8 static inline
+_waiting_pattern(const map_info& map, const board_t& board, const coord col, const coord row) {
+    auto stride = map.width;
+    coosq offset = row * stride + col;
+
+    if (board[offset] != cell::rock) {
+        return 0;
+    }
+
+    cell left = col > 0 ? board[offset - 1] : cell::none;
+    cell right = col + 1 < map.width ? board[offset + 1] : cell::none;
+    cell down = row + 1 < map.height ? board[offset + stride] : cell::none;
+
+    if (down == cell::empty) {
+        return 1;
+    }
+    else if (down == cell::rock) {
+        cell downright = col + 1 < map.width && row + 1 < map.height ? board[offset + stride + 1] : cell::none;
+        cell downleft = col > 0 && row + 1 < map.height ? board[offset + stride - 1] : cell::none;
+
+        return (right == cell::empty && downright == cell::empty) ||
+            (left == cell::empty && downleft == cell::empty);
+    }
+    else if (down == cell::lambda) {
+        cell downright = col + 1 < map.width && row + 1 < map.height ? board[offset + stride + 1] : cell::none;
+
+        return right == cell::empty && downright == cell::empty;
+    }
+
+    return 0;
+}
+
+
+// the fallback without SSE2, and the reference the tests hold the vector scan to
+#if !defined(__SSE2__) || defined(PAIV_TEST)
+
+void static
+_scan_goals_scalar(const map_info& map, const board_t& board, goal_set& gs) {
+    gs.goals.assign((board.size() + 63) / 64, 0);
+    gs.waiting.assign((board.size() + 63) / 64, 0);
+
+    for (coord row = 0; row < map.height; row++) {
+        for (coord col = 0; col < map.width; col++) {
+            coosq offset = row * map.width + col;
+            _set_bit(gs.goals, offset, _goal_pattern(map, board, col, row));
+            _set_bit(gs.waiting, offset, _waiting_pattern(map, board, col, row));
+        }
+    }
+}
+
+#endif
+
+
+#ifdef __SSE2__
+
+static constexpr coord packed_lane = 16;
+
+
+// rows padded with cell::none, goal_radius cells to the left, a lane and more to the
+// right, and one row above and below, so every shifted load stays inside.
+// Laid out in a buffer the caller keeps between scans.
+typedef struct packed_board {
+    vector<u8>& cells;
+    coord stride;
+
+    packed_board(const map_info& map, const board_t& board, vector<u8>& cells) : cells(cells) {
+        stride = (map.width + packed_lane - 1) / packed_lane * packed_lane + packed_lane;
+        cells.assign((map.height + 2) * stride, u8(cell::none));
+
+        for (coord row = 0; row < map.height; row++) {
+            for (coord col = 0; col < map.width; col++) {
+                cells[(row + 1) * stride + goal_radius + col] = u8(board[row * map.width + col]);
+            }
+        }
+    }
+
+    __m128i load(const coord col, const coord row) const {
+        return _mm_loadu_si128((const __m128i*) &cells[(row + 1) * stride + goal_radius + col]);
+    }
+} packed_board;
+
+
+void static inline
+_or_bits(vector<u64>& bits, const coosq offset, u64 mask, const coord count) {
+    mask &= (u64(1) << count) - 1;
+    bits[offset / 64] |= mask << (offset % 64);
+    if (offset % 64 + count > 64) {
+        bits[offset / 64 + 1] |= mask >> (64 - offset % 64);
+    }
+}
+
+
+// the same rules as _goal_pattern and _waiting_pattern, sixteen cells at a time
+void static
+_scan_goals_sse2(const map_info& map, const board_t& board, goal_set& gs) {
+    gs.goals.assign((board.size() + 63) / 64, 0);
+    gs.waiting.assign((board.size() + 63) / 64, 0);
+
+    static thread_local vector<u8> buffer;
+    packed_board packed(map, board, buffer);
+
+    auto is = [] (const __m128i x, const cell value) {
+        return _mm_cmpeq_epi8(x, _mm_set1_epi8(char(value)));
+    };
+
+    for (coord row = 0; row < map.height; row++) {
+        for (coord col = 0; col < map.width; col += packed_lane) {
+            auto at = packed.load(col, row);
+            auto up = packed.load(col, row - 1);
+            auto upleft = packed.load(col - 1, row - 1);
+            auto down = packed.load(col, row + 1);
+            auto downleft = packed.load(col - 1, row + 1);
+            auto downright = packed.load(col + 1, row + 1);
+            auto left = packed.load(col - 1, row);
+            auto left2 = packed.load(col - 2, row);
+            auto left3 = packed.load(col - 3, row);
+            auto right = packed.load(col + 1, row);
+            auto right2 = packed.load(col + 2, row);
+            auto right3 = packed.load(col + 3, row);
+
+            auto passable = [&] (const __m128i x) {
+                return _mm_or_si128(_mm_or_si128(is(x, cell::empty), is(x, cell::earth)), is(x, cell::lambda));
+            };
+
+            auto left_rock = is(left, cell::rock);
+            auto right_rock = is(right, cell::rock);
+            auto left_empty = is(left, cell::empty);
+            auto right_empty = is(right, cell::empty);
+
+            auto beside = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_and_si128(is(left, cell::lambda), is(upleft, cell::rock)),
+                    _mm_and_si128(left_empty, _mm_or_si128(is(left2, cell::rock),
+                        _mm_and_si128(is(left2, cell::empty), is(left3, cell::rock))))),
+                _mm_and_si128(right_empty, _mm_or_si128(is(right2, cell::rock),
+                    _mm_and_si128(is(right2, cell::empty), is(right3, cell::rock)))));
+
+            auto earth = _mm_or_si128(
+                _mm_or_si128(is(up, cell::rock), _mm_and_si128(left_rock, passable(left2))),
+                _mm_andnot_si128(left_rock, _mm_or_si128(
+                    _mm_and_si128(right_rock, passable(right2)),
+                    _mm_andnot_si128(right_rock, beside))));
+
+            auto rock = is(at, cell::rock);
+
+            auto push = _mm_or_si128(
+                _mm_and_si128(is(left, cell::robot), right_empty),
+                _mm_and_si128(is(right, cell::robot), left_empty));
+
+            auto goals = _mm_or_si128(
+                _mm_or_si128(is(at, cell::lambda), is(at, cell::openlift)),
+                _mm_or_si128(_mm_and_si128(is(at, cell::earth), earth), _mm_and_si128(rock, push)));
+
+            auto slide_right = _mm_and_si128(right_empty, is(downright, cell::empty));
+            auto slide_left = _mm_and_si128(left_empty, is(downleft, cell::empty));
+
+            auto waiting = _mm_and_si128(rock, _mm_or_si128(
+                _mm_or_si128(is(down, cell::empty), _mm_and_si128(is(down, cell::lambda), slide_right)),
+                _mm_and_si128(is(down, cell::rock), _mm_or_si128(slide_right, slide_left))));
+
+            auto count = min(packed_lane, coord(map.width - col));
+            coosq offset = row * map.width + col;
+
+            _or_bits(gs.goals, offset, u64(_mm_movemask_epi8(goals)), count);
+            _or_bits(gs.waiting, offset, u64(_mm_movemask_epi8(waiting)), count);
+        }
+    }
+}
+
+#endif
+
+
+void static inline
+_scan_goals(const map_info& map, const board_t& board, goal_set& gs) {
+    #ifdef __SSE2__
+    _scan_goals_sse2(map, board, gs);
+    #else
+    _scan_goals_scalar(map, board, gs);
+    #endif
+}
+
+
+// a cell's patterns read up to goal_radius cells along its row and one row up or down,
+// so a change only has to be followed by a look at that window around it
+static constexpr size_t goal_window = 3 * (2 * goal_radius + 1);
+
+
+// keeps a set following a move made with undo, or drops it once it lost track of the board
+// or revisiting the changes would cost more than a full scan
+void static inline
+note_changes(goal_set& gs, const undo_t& undo, const u64 board_hash, const size_t cells) {
+    if (gs.goals.empty()) {
+        return;
+    }
+
+    auto tip = gs.changed.empty() ? gs.board_hash : gs.changed_hash;
+
+    if (tip != undo.board_hash || (gs.changed.size() + undo.cells.size()) * goal_window > cells) {
+        gs.goals.clear();
+        gs.changed.clear();
+        return;
+    }
+
+    for (auto& x : undo.cells) {
+        gs.changed.push_back(x.first);
+    }
+    gs.changed_hash = board_hash;
+}
+
+
+u8 static inline
+goals_current(const goal_set& gs, const sim_state& sim) {
+    return gs.goals.size() == (sim.board.size() + 63) / 64 && gs.board_hash == sim.board_hash;
+}
+
+
+void static
+update_goals(const map_info& map, const board_t& board, const u64 board_hash, goal_set& gs) {
+    auto stride = map.width;
+
+    auto visit = [&] (const coord col, const coord row) {
+        coosq offset = row * stride + col;
+        _set_bit(gs.goals, offset, _goal_pattern(map, board, col, row));
+        _set_bit(gs.waiting, offset, _waiting_pattern(map, board, col, row));
+    };
+
+    auto known = gs.board_hash == board_hash || (!gs.changed.empty() && gs.changed_hash == board_hash);
+
+    if (gs.goals.size() != (board.size() + 63) / 64 || !known) {
+        _scan_goals(map, board, gs);
+    }
+    else {
+        for (auto offset : gs.changed) {
+            coord x = offset % stride;
+            coord y = offset / stride;
+
+            for (coord row = max(0, y - 1); row <= min(map.height - 1, y + 1); row++) {
+                for (coord col = max(0, x - goal_radius); col <= min(map.width - 1, x + goal_radius); col++) {
+                    visit(col, row);
+                }
+            }
+        }
+    }
+
+    gs.board_hash = board_hash;
+    gs.changed.clear();
+}
+
+
+void static inline
+update_goals(const map_info& map, search_state& state) {
+    update_goals(map, state.sim.board, state.sim.board_hash, state.goals);
+}
+
+
+// simulator_make that keeps the state's goal set following the board
+void static inline
+make_tracked(const map_info& map, search_state& state, const action mv) {
+    if (state.goals.goals.empty()) {
+        simulator_make(map, state.sim, mv);
+        return;
+    }
+
+    static thread_local undo_t undo;
+    simulator_make(map, state.sim, mv, &undo);
+    note_changes(state.goals, undo, state.sim.board_hash, state.sim.board.size());
+}
+
+
 struct memo_t {
     typedef program_t Key;
     typedef search_state Value;
-    typedef list<pair<Key,Value>> Container;
+    typedef list<pair<Key,Value>, slab_allocator<pair<Key,Value>>> Container;
     typedef Container::const_iterator Iter;
-    typedef unordered_map<Key, Iter> Map;
+    typedef unordered_map<Key, Iter, hash<Key>, equal_to<Key>, slab_allocator<pair<const Key, Iter>>> Map;
 
     static constexpr size_t max_size = 200 * 1024 * 1024 / sizeof(Value);
 
@@ -62,143 +452,421 @@ struct memo_t {
 };
 
 
+// nodes are simulated only when the lazy search pops them, and keep their last
+// move and parent instead of a full program
 typedef struct path_search_graph {
-    typedef search_state Node;
-    typedef program_t Location;
-    typedef program_t Path;
+    typedef u32 Location;
+    typedef action Move;
     typedef s32 Distance;
 
-    static constexpr Distance MaxDistance = s32_max;
+    static constexpr Location no_parent = numeric_limits<Location>::max();
 
     const map_info& map;
-    const Location root;
-    unordered_map<Location, search_state> tree;
-    unordered_set<u64> visited;
+    const program_t& root_prog;
+    const pos goal;
+    arena pool;
+    vector<sim_state, arena_allocator<sim_state>> nodes;
+    vector<Location, arena_allocator<Location>> parents;
+    vector<action, arena_allocator<action>> last;
+    vector<u32, arena_allocator<u32>> depth;
+    arena_set<u64> visited;
+
+    path_search_graph(const map_info& map, const sim_state& initial, const program_t& root_prog, const pos& goal) :
+        map(map), root_prog(root_prog), goal(goal), nodes(pool), parents(pool), last(pool), depth(pool),
+        visited(pool) {
+        nodes.push_back(initial);
+        parents.push_back(Location(no_parent));
+        last.push_back(action::abort);
+        depth.push_back(root_prog.size());
+        visited.insert(initial.board_hash);
+    }
 
-    path_search_graph(const map_info& map, const sim_state& initial, const Location& root) : map(map), root(root) {
-        u8 is_win = initial.robot_pos == map.lift_pos;
-        tree[root] = {initial, is_win, root};
+    u8 check_goal(const Location at) const {
+        return nodes[at].robot_pos == goal;
     }
 
-    Location stub_node(const pos& at) {
-        search_state state = {};
-        state.sim.robot_pos = at;
-        state.prog = { action::abort };
-        tree[state.prog] = state;
-        return state.prog;
+    void moves(const Location from, vector<Move>& res) const {
+        res.clear();
+        if (depth[from] >= u32(map.width * map.height)) {
+            return;
+        }
+
+        res = legal_moves(map, nodes[from], {}, {}, 0, 1);
+
+        if (parents[from] != no_parent) {
+            const auto& grandparent = nodes[parents[from]];
+            auto mv = last[from];
+            res.erase(remove_if(begin(res), end(res), [&] (const action x) {
+                return !is_canonical(map, grandparent, mv, x);
+            }), end(res));
+        }
     }
 
-    u8 check_goal(const Location& at, const Location& goal) const {
-        auto fromit = tree.find(at);
-        auto goalit = tree.find(goal);
-        if (fromit != end(tree) && goalit != end(tree)) {
-            return fromit->second.sim.robot_pos == goalit->second.sim.robot_pos;
+    Distance move_distance(const Location, const Move) const {
+        return 1;
+    }
+
+    Distance move_estimate(const Location from, const Move mv) const {
+        return manhattan_distance(advance_pos(nodes[from].robot_pos, mv), goal);
+    }
+
+    u8 make(const Location from, const Move mv, Location& child) {
+        auto sim = nodes[from];
+        undo_t undo;
+        simulator_make(map, sim, mv, &undo);
+
+        if (!visited.insert(sim.board_hash).second) {
+            return 0;
         }
-        return 0;
+
+        if (!sim.is_ended && rocks_moved(undo) && !is_reachable(map, sim, goal)) {
+            return 0;
+        }
+
+        child = nodes.size();
+        nodes.push_back(move(sim));
+        parents.push_back(from);
+        last.push_back(mv);
+        depth.push_back(depth[from] + 1);
+        return 1;
     }
 
-    vector<Location> children(const Location& from) {
-        auto fromit = tree.find(from);
-        if (fromit == end(tree)) {
-            return {};
+    search_state state(const Location at) const {
+        program_t tail;
+        for (auto x = at; parents[x] != no_parent; x = parents[x]) {
+            tail.push_back(last[x]);
         }
 
-        auto parent = fromit->second;
+        search_state res = {nodes[at], nodes[at].robot_pos == map.lift_pos, root_prog};
+        res.prog.insert(end(res.prog), tail.rbegin(), tail.rend());
+        return res;
+    }
+} path_search_graph;
 
-        visited.insert(parent.sim.board_hash);
 
-        vector<Location> res;
+typedef struct search_cost {
+    u32 calls;
+    u32 found;
+    r64 spent;
+    r64 spent_found;
+    r64 spent_missed;
+    u32 missed;     // searches cut off by their slice since the last success
+} search_cost;
 
-        auto moves = legal_moves(map, parent.sim, parent.prog);
 
-        for (auto mv : moves) {
-            #if 0
-            switch (mv) {
-                case action::left: {
-                        auto& pp = parent.sim.robot_pos;
-                        auto& board = parent.sim.board;
-                        cell left = board[pp.y * map.width + pp.x - 1];
-                        if (left == cell::rock) {
-                            continue;
-                        }
-                    }
-                    break;
-                case action::right: {
-                        auto& pp = parent.sim.robot_pos;
-                        auto& board = parent.sim.board;
-                        cell left = board[pp.y * map.width + pp.x + 1];
-                        if (left == cell::rock) {
-                            continue;
-                        }
-                    }
-                    break;
-                default:
-                    break;
+static constexpr r64 budget_min_slice = 0.002;
+static constexpr r64 budget_cost_margin = 4.0;
+static constexpr r64 budget_retry_growth = 2.0;
+static constexpr u32 budget_max_retry_steps = 4;
+static constexpr r64 budget_retry_share = 0.1;
+
+
+struct time_budget {
+    const deadline_t& deadline;
+    search_cost total;
+    unordered_map<pos, search_cost> goals;
+    unordered_map<pos, u32> tour;   // lambda visiting order, a move-ordering prior for the players
+    mutable mutex lock;
+
+    time_budget(const deadline_t& deadline) : deadline(deadline), total() {
+    }
+
+    void set_tour(const vector<pos>& order) {
+        tour.clear();
+        for (u32 i = 0; i < order.size(); i++) {
+            tour[order[i]] = i;
+        }
+    }
+
+    u32 tour_rank(const pos& goal) const {
+        auto it = tour.find(goal);
+        return it != end(tour) ? it->second : u32(tour.size());
+    }
+
+    r64 timeleft() const {
+        return deadline.timeleft();
+    }
+
+    r64 allot(const pos& goal, const r64 gain, const r64 pool, const r64 pool_gain) const {
+        auto share = pool_gain > 0 ? pool * gain / pool_gain : pool;
+        auto tm = share;
+
+        lock_guard<mutex> guard(lock);
+
+        if (total.found > 0) {
+            auto expected = total.spent_found / total.found;
+            tm = min(tm, max(budget_min_slice, budget_cost_margin * expected));
+        }
+
+        // each search cut off by its slice doubles the goal's next one, so paths longer than the usual still get found.
+        // Bounded per goal and in total, or goals no search can reach would take over the pool.
+        auto it = goals.find(goal);
+        if (it != end(goals) && total.spent_missed <= budget_retry_share * total.spent) {
+            auto steps = min(it->second.missed, u32(budget_max_retry_steps));
+            for (u32 i = 0; i < steps && tm < share; i++) {
+                tm *= budget_retry_growth;
             }
-            #endif
+            tm = min(tm, share);
+        }
+
+        return min(tm, timeleft());
+    }
+
+    void record(const pos& goal, const r64 spent, const u8 found, const u8 timed_out) {
+        lock_guard<mutex> guard(lock);
+
+        for (auto cost : {&total, &goals[goal]}) {
+            cost->calls++;
+            cost->spent += spent;
+            if (found) {
+                cost->found++;
+                cost->spent_found += spent;
+                cost->missed = 0;
+            }
+            else if (timed_out) {
+                cost->missed++;
+                cost->spent_missed += spent;
+            }
+        }
+    }
+};
+
+
+r64 static inline
+goal_gain(const map_info& map, const search_state& state, const pos& goal) {
+    switch (state.sim.board[goal.y * map.width + goal.x]) {
+        case cell::lambda:
+            return 50;
+        case cell::openlift:
+            return max(50, 25 * (s32) state.sim.lambdas_collected);
+        default:
+            return 1;
+    }
+}
+
+
+typedef struct path_ida_graph {
+    typedef action Move;
+    typedef s32 Distance;
+
+    const map_info& map;
+    const pos goal;
+    search_state state;
+    vector<undo_t> undo;
+
+    path_ida_graph(const map_info& map, const search_state& initial, const pos& goal) :
+        map(map), goal(goal), state(initial) {
+    }
+
+    Distance estimate() const {
+        return manhattan_distance(state.sim.robot_pos, goal);
+    }
+
+    u8 check_goal() const {
+        return state.sim.robot_pos == goal;
+    }
+
+    u64 hash() const {
+        return state.sim.board_hash;
+    }
+
+    void moves(vector<Move>& res) const {
+        res = legal_moves(map, state.sim, state.prog);
+    }
+
+    u8 make(const Move mv, const u32 depth) {
+        if (undo.size() <= depth) {
+            undo.resize(depth + 1);
+        }
+
+        simulator_make(map, state.sim, mv, &undo[depth]);
+        state.prog.push_back(mv);
+
+        if (state.sim.is_ended && state.sim.robot_pos != goal) {
+            unmake(depth);
+            return 0;
+        }
+
+        if (!state.sim.is_ended && rocks_moved(undo[depth]) && !is_reachable(map, state.sim, goal)) {
+            unmake(depth);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    void unmake(const u32 depth) {
+        simulator_unmake(state.sim, undo[depth]);
+        state.prog.pop_back();
+    }
 
-            auto sim = simulator_step(map, parent.sim, mv);
-            auto path = parent.prog;
-            path.push_back(mv);
+} path_ida_graph;
+
+
+static constexpr size_t ida_min_cells = 64 * 64;
+static constexpr size_t ida_table_bytes = 16 * 1024 * 1024;
+
+
+search_state static
+find_path_ida(const map_info& map, const search_state& initialState, const pos& goal,
+    const deadline_t& deadline, const size_t memory = ida_table_bytes) {
+
+    path_ida_graph gen(map, initialState, goal);
+
+    idastar::search<path_ida_graph> find_path(gen, memory);
+    find_path(deadline);
+
+    if (gen.check_goal()) {
+        auto& state = gen.state;
+        auto steps = state.prog.size() - initialState.prog.size();
+
+        for (size_t depth = 0; depth < steps; depth++) {
+            auto next = depth + 1 < steps ? gen.undo[depth + 1].board_hash : state.sim.board_hash;
+            note_changes(state.goals, gen.undo[depth], next, state.sim.board.size());
+        }
+
+        state.is_win = state.sim.is_ended && state.sim.robot_pos == map.lift_pos;
+        return state;
+    }
+
+    search_state invalid;
+    invalid.sim.robot_pos = {-1, -1};
+
+    return invalid;
+}
 
-            if (visited.find(sim.board_hash) != end(visited)) {
+
+// grid search on a snapshot with rocks and the cells below them as walls,
+// trusted only after the simulator agrees with every step
+search_state static
+find_path_static(const map_info& map, const search_state& initialState, const pos& goal) {
+    const auto& board = initialState.sim.board;
+    auto stride = map.width;
+
+    search_state invalid;
+    invalid.sim.robot_pos = {-1, -1};
+
+    vector<u8> blocked(board.size(), 0);
+
+    for (coosq offset = 0; offset < board.size(); offset++) {
+        switch (board[offset]) {
+            case cell::empty:
+            case cell::earth:
+            case cell::lambda:
+            case cell::robot:
+                break;
+            case cell::openlift:
+                blocked[offset] = offset != coosq(goal.y * stride + goal.x);
+                break;
+            default:
+                blocked[offset] = 1;
+                break;
+        }
+    }
+
+    auto fall_zone = [&] (const coord col, coord row) {
+        for (; row < map.height && board[row * stride + col] == cell::empty; row++) {
+            blocked[row * stride + col] = 1;
+        }
+    };
+
+    for (coord row = 0; row + 1 < map.height; row++) {
+        for (coord col = 0; col < map.width; col++) {
+            if (board[row * stride + col] != cell::rock) {
                 continue;
             }
 
-            u8 is_win = sim.robot_pos == map.lift_pos;
-            tree[path] = {sim, is_win, path};
-            res.push_back(path);
+            auto below = board[(row + 1) * stride + col];
+            if (below == cell::empty) {
+                fall_zone(col, row + 1);
+            }
+            else if (below == cell::rock || below == cell::lambda) {
+                if (col + 1 < map.width && board[row * stride + col + 1] == cell::empty) {
+                    fall_zone(col + 1, row + 1);
+                }
+                if (below == cell::rock && col > 0 && board[row * stride + col - 1] == cell::empty) {
+                    fall_zone(col - 1, row + 1);
+                }
+            }
         }
+    }
 
-        return res;
+    coosq start = initialState.sim.robot_pos.y * stride + initialState.sim.robot_pos.x;
+    coosq target = goal.y * stride + goal.x;
+
+    if (blocked[target]) {
+        return invalid;
     }
 
-    Path path(const Node& from, const Node& to) const {
-        auto it = begin(to.prog);
-        for (auto x = begin(from.prog);
-            x != end(from.prog) && it != end(to.prog) && *x == *it;
-            x++, it++) {
+    vector<u8> from(board.size(), u8(action::abort));
+    deque<coosq> fringe = {start};
+    from[start] = u8(action::wait);
+
+    while (!fringe.empty() && from[target] == u8(action::abort)) {
+        auto offset = fringe.front();
+        fringe.pop_front();
+        pos at = {coord(offset % stride), coord(offset / stride)};
+
+        for (auto mv : {action::left, action::right, action::up, action::down}) {
+            auto next = advance_pos(at, mv);
+            if (next.x < 0 || next.x >= map.width || next.y < 0 || next.y >= map.height) {
+                continue;
+            }
+
+            coosq k = next.y * stride + next.x;
+            if (!blocked[k] && from[k] == u8(action::abort)) {
+                from[k] = u8(mv);
+                fringe.push_back(k);
+            }
         }
+    }
 
-        return Path(it, end(to.prog));
+    if (from[target] == u8(action::abort)) {
+        return invalid;
     }
 
-    Distance distance(const Location& from, const Location& to) const {
-        auto fromit = tree.find(from);
-        auto toit = tree.find(to);
-        if (fromit != end(tree) && toit != end(tree)) {
-            return path(fromit->second, toit->second).size();
+    program_t moves;
+    for (auto at = goal; at != initialState.sim.robot_pos; ) {
+        auto mv = action(from[at.y * stride + at.x]);
+        moves.push_back(mv);
+        switch (mv) {
+            case action::left: at.x++; break;
+            case action::right: at.x--; break;
+            case action::up: at.y++; break;
+            case action::down: at.y--; break;
+            default: break;
         }
-        return MaxDistance;
     }
 
-    Distance path_estimate(const Location& from, const Location& goal) const {
-        auto fromit = tree.find(from);
-        auto goalit = tree.find(goal);
-        if (fromit != end(tree) && goalit != end(tree)) {
-            return manhattan_distance(fromit->second.sim.robot_pos, goalit->second.sim.robot_pos);
+    auto state = initialState;
+
+    for (auto it = moves.rbegin(); it != moves.rend(); it++) {
+        auto expected = advance_pos(state.sim.robot_pos, *it);
+        make_tracked(map, state, *it);
+        state.prog.push_back(*it);
+
+        if (state.sim.robot_pos != expected || (state.sim.is_ended && state.sim.robot_pos != map.lift_pos)) {
+            return invalid;
         }
-        return MaxDistance;
     }
 
-} path_search_graph;
+    state.is_win = state.sim.is_ended && state.sim.robot_pos == map.lift_pos;
+    return state;
+}
 
 
 search_state static
-find_path(const map_info& map, const search_state& initialState, const pos& goal,
-    const r64 timelimit, const u8& cancelled) {
-
-    auto started = appclock::now();
+find_path_astar(const map_info& map, const search_state& initialState, const pos& goal,
+    const deadline_t& deadline) {
 
-    path_search_graph gen(map, initialState.sim, initialState.prog);
-    auto goal_state = gen.stub_node(goal);
+    path_search_graph gen(map, initialState.sim, initialState.prog, goal);
 
-    astar::search<path_search_graph> find_path(gen);
-    auto path = find_path(gen.root, goal_state, timelimit);
+    astar::lazy_search<path_search_graph> find_path(gen);
+    auto path = find_path(0, deadline);
 
     if (path.size() > 0) {
         // logger << "found " << path.back() << endl;
-        return gen.tree[path.back()];
+        return gen.state(path.back());
     }
 
     search_state invalid;
@@ -208,120 +876,66 @@ find_path(const map_info& map, const search_state& initialState, const pos& goal
 }
 
 
+search_state static
+find_path(const map_info& map, const search_state& initialState, const pos& goal,
+    const deadline_t& deadline, time_budget& budget) {
+
+    auto quick = find_path_static(map, initialState, goal);
+    if (quick.sim.robot_pos == goal) {
+        return quick;
+    }
+
+    auto started = appclock::now();
+
+    if (size_t(map.width * map.height) > ida_min_cells) {
+        auto state = find_path_ida(map, initialState, goal, deadline);
+
+        chrono::duration<r64> elapsed = appclock::now() - started;
+        budget.record(goal, elapsed.count(), state.sim.robot_pos == goal, deadline.expired());
+
+        return state;
+    }
+
+    // the grid search keeps no change log, the next update rescans into the inherited buffers
+    auto state = find_path_astar(map, initialState, goal, deadline);
+    state.goals = initialState.goals;
+
+    chrono::duration<r64> elapsed = appclock::now() - started;
+    budget.record(goal, elapsed.count(), state.sim.robot_pos == goal, deadline.expired());
+
+    return state;
+}
+
+
 unordered_set<pos> static inline
 plan_goals(const map_info& map, const search_state& state) {
-    const auto& board = state.sim.board;
     auto stride = map.width;
 
     unordered_set<pos> goals;
-    u8 waiting_ok = 0;
 
-    for (coord row = 0; row < map.height; row++) {
-        for (coord col = 0; col < map.width; col++) {
-
-            cell value = board[row * stride + col];
+    auto reach = analyse_reach(map, state.sim);
+    if (reach.is_dead()) {
+        return goals;
+    }
 
-            switch (value) {
+    goal_set local;
+    auto gs = &state.goals;
 
-                case cell::lambda:
-                case cell::openlift:
-                    goals.insert({col, row});
-                    break;
+    if (!goals_current(*gs, state.sim)) {
+        local = state.goals;
+        update_goals(map, state.sim.board, state.sim.board_hash, local);
+        gs = &local;
+    }
 
-                case cell::earth: {
-                        coosq offset = row * stride + col;
-                        cell up = row > 0 ? board[offset - stride] : cell::none;
-                        cell left = col > 0 ? board[offset - 1] : cell::none;
-                        cell upleft = (row > 0 && col > 0) ? board[offset - stride - 1] : cell::none;
-                        cell right = col + 1 < map.width ? board[offset + 1] : cell::none;
-                        cell left2 = col > 1 ? board[offset - 2] : cell::none;
-                        cell left3 = col > 2 ? board[offset - 3] : cell::none;
-                        cell right2 = col + 2 < map.width ? board[offset + 2] : cell::none;
-                        cell right3 = col + 3 < map.width ? board[offset + 3] : cell::none;
-
-                        if (up == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                        else if (left == cell::rock) {
-                            switch (left2) {
-                                case cell::empty:
-                                case cell::earth:
-                                case cell::lambda:
-                                    goals.insert({col, row});
-                                    break;
-                                default:
-                                    break;
-                            }
-                        }
-                        else if (right == cell::rock) {
-                            switch (right2) {
-                                case cell::empty:
-                                case cell::earth:
-                                case cell::lambda:
-                                    goals.insert({col, row});
-                                    break;
-                                default:
-                                    break;
-                            }
-                        }
-                        else if (left == cell::lambda && upleft == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                        else if (left == cell::empty && left2 == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                        else if (left == cell::empty && left2 == cell::empty && left3 == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                        else if (right == cell::empty && right2 == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                        else if (right == cell::empty && right2 == cell::empty && right3 == cell::rock) {
-                            goals.insert({col, row});
-                        }
-                    }
-                    break;
+    u8 waiting_ok = 0;
 
-                case cell::rock: {
-                        coosq offset = row * stride + col;
-                        cell left = col > 0 ? board[offset - 1] : cell::none;
-                        cell right = col + 1 < map.width ? board[offset + 1] : cell::none;
-
-                        if (left == cell::robot && right == cell::empty) {
-                            goals.insert({col, row});
-                        }
-                        else if (right == cell::robot && left == cell::empty) {
-                            goals.insert({col, row});
-                        }
-
-                        if (!waiting_ok) {
-                            cell down = row + 1 < map.height ? board[offset + stride] : cell::none;
-
-                            if (down == cell::empty) {
-                                waiting_ok = 1;
-                            }
-                            else if (down == cell::rock) {
-                                cell downright = col + 1 < map.width && row + 1 < map.height ? board[offset + stride + 1] : cell::none;
-                                cell downleft = col > 0 && row + 1 < map.height ? board[offset + stride - 1] : cell::none;
-
-                                waiting_ok = (right == cell::empty && downright == cell::empty) ||
-                                    (left == cell::empty && downleft == cell::empty);
-                            }
-                            else if (down == cell::lambda) {
-                                cell downright = col + 1 < map.width && row + 1 < map.height ? board[offset + stride + 1] : cell::none;
-
-                                waiting_ok = right == cell::empty && downright == cell::empty;
-                            }
-                        }
-                    }
-                    break;
+    for (size_t k = 0; k < gs->goals.size(); k++) {
+        waiting_ok |= gs->waiting[k] != 0;
 
-                case cell::none:
-                case cell::empty:
-                case cell::wall:
-                case cell::lift:
-                case cell::robot:
-                    break;
+        for (auto word = gs->goals[k]; word != 0; word &= word - 1) {
+            coosq offset = k * 64 + __builtin_ctzll(word);
+            if (reach.reachable(offset)) {
+                goals.insert({coord(offset % stride), coord(offset / stride)});
             }
         }
     }
@@ -337,7 +951,7 @@ plan_goals(const map_info& map, const search_state& state) {
 search_state static inline
 advance_search(const map_info& map, const search_state& currentState, action mv) {
     auto state = currentState;
-    state.sim = simulator_step(map, state.sim, mv);
+    make_tracked(map, state, mv);
     state.is_win = state.sim.is_ended && state.sim.robot_pos == map.lift_pos;
     state.prog.push_back(mv);
     return state;
@@ -345,14 +959,37 @@ advance_search(const map_info& map, const search_state& currentState, action mv)
 
 
 vector<search_state> static inline
-plan_children(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
+plan_children(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
+
     vector<search_state> res;
 
     auto goals = plan_goals(map, initialState);
 
-    auto tm = timelimit / (goals.size() + 2);
+    vector<pair<r64, pos>> ranked;
+    r64 pool_gain = 0;
 
     for (auto& goal : goals) {
+        auto gain = goal_gain(map, initialState, goal);
+        ranked.push_back(make_pair(gain, goal));
+        pool_gain += gain;
+    }
+
+    sort(begin(ranked), end(ranked), [&budget](const pair<r64, pos>& a, const pair<r64, pos>& b) {
+        return a.first > b.first || (a.first == b.first && budget.tour_rank(a.second) < budget.tour_rank(b.second));
+    });
+
+    for (auto& x : ranked) {
+        if (deadline.expired()) {
+            break;
+        }
+
+        auto gain = x.first;
+        auto& goal = x.second;
+
+        auto tm = budget.allot(goal, gain, deadline.timeleft(), pool_gain);
+        pool_gain -= gain;
+
         if (goal == initialState.sim.robot_pos) {
             auto state = advance_search(map, initialState, action::wait);
 
@@ -361,7 +998,7 @@ plan_children(const map_info& map, const search_state& initialState, const r64 t
             }
         }
         else {
-            auto state = find_path(map, initialState, goal, tm, cancelled);
+            auto state = find_path(map, initialState, goal, deadline.slice(tm), budget);
             // logger << "path from " << initialState.sim.robot_pos << " to " << goal << ": " << state.prog << endl;
 
             if (state.sim.robot_pos == goal) {
@@ -388,13 +1025,17 @@ _difference(const unordered_set<T>& a, const unordered_set<T>& b) {
 
 
 search_state static inline
-plan_random(const map_info& map, const search_state& initialState, const u8& cancelled, const unordered_set<pos>& exclude = {}) {
+plan_random(const map_info& map, const search_state& initialState, const deadline_t& deadline, time_budget& budget,
+    const unordered_set<pos>& exclude = {}) {
+
     auto goals = plan_goals(map, initialState);
     goals = _difference(goals, exclude);
 
     if (goals.size() > 0) {
         auto goal = *random_choice(begin(goals), end(goals));
-        auto state = find_path(map, initialState, goal, 1.0, cancelled);
+        auto gain = goal_gain(map, initialState, goal);
+        auto tm = budget.allot(goal, gain, deadline.timeleft() / 4, gain);
+        auto state = find_path(map, initialState, goal, deadline.slice(tm), budget);
         if (state.sim.robot_pos == goal) {
             return state;
         }
@@ -407,8 +1048,8 @@ plan_random(const map_info& map, const search_state& initialState, const u8& can
 
 
 search_state static inline
-player_bfs(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
-    auto started = appclock::now();
+player_bfs(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
 
     queue<search_state> fringe;
     unordered_set<u64> visited;
@@ -417,13 +1058,7 @@ player_bfs(const map_info& map, const search_state& initialState, const r64 time
 
     search_state best = initialState;
 
-    while (fringe.size() > 0) {
-        auto now = appclock::now();
-        chrono::duration<r64> elapsed = now - started;
-        if (elapsed.count() >= timelimit) {
-            break;
-        }
-
+    while (fringe.size() > 0 && !deadline.expired()) {
         auto current = fringe.front();
         fringe.pop();
 
@@ -436,15 +1071,20 @@ player_bfs(const map_info& map, const search_state& initialState, const r64 time
 
         if (current.sim.score > best.sim.score) {
             best = current;
+            checkpoint.offer(best.prog, best.sim.score);
         }
 
         if (current.is_win) { // bfs
             break;
         }
 
-        auto tm = timelimit / (map.lambdas_total * map.lambdas_total * map.lambdas_total + 2);
+        if (score_bound(map, current.sim) <= best.sim.score) {
+            continue;
+        }
+
+        auto tm = deadline.timeleft() / (fringe.size() + 1);
 
-        for (auto child : plan_children(map, current, tm, cancelled)) {
+        for (auto child : plan_children(map, current, deadline.slice(tm), budget)) {
             // logger << "  child " << child.sim.robot_pos << " " << child.prog << endl;
             fringe.push(child);
         }
@@ -454,42 +1094,66 @@ player_bfs(const map_info& map, const search_state& initialState, const r64 time
 }
 
 
-typedef struct node {
-    u64 board_hash;
-    u32 visits;
-    r64 acc_score;
-    node* parent;
-    vector<node*> children;
-    program_t prog;
-    u8 explored;
-} node;
+static constexpr size_t mc_tree_budget = 500 * 1024 * 1024;
+
+
+// a node holds only the plan step from its parent; its program is the chain of steps up to the root
+typedef struct mc_step {
+    program_t moves;
+    u32 length;
+} mc_step;
+
+typedef uct_tree<mc_step> mc_tree;
 
 
 r64 static inline
-mc_select_heuristic(const node& n) {
+mc_select_heuristic(const r64 mean, const u32 visits, const r64 log_parent) {
     #if 0
-    return n.acc_score / n.visits + sqrt(2.0 * log(n.parent->visits) / n.visits);
+    return mean + sqrt(2.0 * log_parent / visits);
     #else
-    return n.acc_score / n.visits / 10000.0 + sqrt(2.0 * log(n.parent->visits) / n.visits);
+    return mean / 10000.0 + sqrt(2.0 * log_parent / visits);
     #endif
 }
 
 
+program_t static
+mc_program(const mc_tree& tree, node_id n, const program_t& root_prog) {
+    vector<node_id> chain;
+    for (; tree.parent[n] != no_node; n = tree.parent[n]) {
+        chain.push_back(n);
+    }
+
+    auto prog = root_prog;
+    for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+        const auto& moves = tree.payload[*it].moves;
+        prog.insert(end(prog), begin(moves), end(moves));
+    }
+    return prog;
+}
+
+
 search_state static inline
-mc_dive(const map_info& map, const search_state& initialState, const u8& cancelled) {
+mc_dive(const map_info& map, const search_state& initialState, const deadline_t& deadline, time_budget& budget,
+    const s32 incumbent = s32_min) {
+
     auto state = initialState;
 
-    unordered_set<u64> visited;
+    arena dive;
+    arena_set<u64> visited(dive);
     visited.insert(state.sim.board_hash);
 
-    while (!state.sim.is_ended && !cancelled) {
+    while (!state.sim.is_ended && !deadline.expired()) {
+        if (score_bound(map, state.sim) <= incumbent) {
+            break;
+        }
+
         unordered_set<pos> exclude;
 
-        auto nextState = plan_random(map, state, cancelled);
+        auto nextState = plan_random(map, state, deadline, budget);
 
-        while (!nextState.sim.is_ended && visited.find(nextState.sim.board_hash) != end(visited) && !cancelled) {
+        while (!nextState.sim.is_ended && visited.find(nextState.sim.board_hash) != end(visited) && !deadline.expired()) {
             exclude.insert(nextState.sim.robot_pos);
-            nextState = plan_random(map, state, cancelled, exclude);
+            nextState = plan_random(map, state, deadline, budget, exclude);
         }
 
         state = nextState;
@@ -501,63 +1165,43 @@ mc_dive(const map_info& map, const search_state& initialState, const u8& cancell
 
 
 search_state static inline
-player_mc(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
-    auto started = appclock::now();
-
-    static constexpr size_t tree_max_size = 500 * 1024 * 1024 / sizeof(node);
-
-    vector<node> search_tree;
-    unordered_map<u64, node*> visited;
-
-    search_tree.reserve(tree_max_size);
+player_mc(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget, const size_t tree_budget = mc_tree_budget) {
 
-    node root = {
-        initialState.sim.board_hash,   // .board_hash
-        0,                      // .visits
-        0,                      // .acc_score
-        nullptr,                // .parent
-        {},                     // .children
-        initialState.prog,      // .prog
-        0,                      // .explored
-    };
-
-    if (search_tree.size() < tree_max_size) {
-        search_tree.push_back(root);
-        visited[initialState.sim.board_hash] = &search_tree.back();
-    }
+    mc_tree tree(tree_budget);
+    auto root = tree.add(no_node, initialState.sim.board_hash, {{}, u32(initialState.prog.size())});
 
     memo_t memo;
     memo.add(initialState.prog, initialState);
 
     auto best = initialState;
+    vector<node_id> candidates;
 
-    while (!cancelled) {
+    while (!deadline.expired()) {
+        auto timeleft = deadline.timeleft();
 
-        auto now = appclock::now();
-        chrono::duration<r64> elapsed = now - started;
-        auto timeleft = timelimit - elapsed.count();
-        if (timeleft <= 0) {
-            break;
+        if (tree.size() > tree.capacity() - tree.capacity() / 8) {
+            tree.collect(root);
         }
 
         // select
         // logger << "select\n";
-        node* selected = &search_tree[0];
+        auto selected = root;
 
-        if (selected->explored) {
+        if (tree.explored[selected]) {
             break;
         }
 
         while (1) {
-            if (selected->visits == 0) {
+            if (!tree.expanded[selected]) {
                 break;
             }
 
-            vector<node*> candidates;
+            candidates.clear();
 
-            for (auto p : selected->children) {
-                if (p != nullptr && p->visits == 0) {
-                    candidates.push_back(p);
+            for (auto c = tree.first_child[selected]; c != no_node; c = tree.next_sibling[c]) {
+                if (tree.visits[c] == 0) {
+                    candidates.push_back(c);
                 }
             }
 
@@ -567,105 +1211,94 @@ player_mc(const map_info& map, const search_state& initialState, const r64 timel
             }
 
             r64 child_score = r64_min;
-            node* best_child = nullptr;
+            node_id best_child = no_node;
+            auto log_parent = log(r64(tree.visits[selected]));
 
-            for (auto p : selected->children) {
-                if (p != nullptr && !p->explored) {
-                    auto score = mc_select_heuristic(*p);
+            for (auto c = tree.first_child[selected]; c != no_node; c = tree.next_sibling[c]) {
+                if (!tree.explored[c]) {
+                    auto score = mc_select_heuristic(tree.mean[c], tree.visits[c], log_parent);
                     if (score > child_score) {
                         child_score = score;
-                        best_child = p;
+                        best_child = c;
                     }
                 }
             }
 
-            if (best_child != nullptr) {
+            if (best_child != no_node) {
                 selected = best_child;
             }
             else {
-                selected->explored = 1;
+                tree.explored[selected] = 1;
                 break;
             }
         }
 
         r64 score = r64_min;
 
-        if (selected->explored) {
-            score = selected->acc_score / selected->visits;
+        if (tree.explored[selected]) {
+            score = tree.mean[selected];
         }
         else {
             // expand
-            // logger << "expand for " << selected->prog << "\n";
+            auto prog = mc_program(tree, selected, initialState.prog);
+            // logger << "expand for " << prog << "\n";
             search_state state = {};
 
-            auto it = memo.find(selected->prog);
+            auto it = memo.find(prog);
             if (it != memo.end()) {
                 state = it->second;
             }
             else {
-                state.sim = runsim(map, initialState.sim, selected->prog, runsim_opts::no_abort);
+                state.sim = runsim(map, initialState.sim, prog, runsim_opts::no_abort);
                 state.is_win = state.sim.is_ended && state.sim.robot_pos == map.lift_pos;
-                state.prog = selected->prog;
+                state.prog = prog;
                 memo.add(state.prog, state);
             }
 
             // logger << "selected: " << state.sim.robot_pos << " " << state.prog << endl;
 
             const auto& selected_state = state;
-            size_t child_index = 0;
 
-            auto children = plan_children(map, selected_state, timeleft / 2, cancelled);
+            auto children = plan_children(map, selected_state, deadline.slice(timeleft / 2), budget);
 
-            selected->explored = children.size() == 0;
+            tree.explored[selected] = children.size() == 0;
+            tree.expanded[selected] = 1;
 
             for (auto& child : children) {
                 // logger << "  child " << child.sim.robot_pos << " " << child.prog << endl;
 
                 auto child_hash = child.sim.board_hash;
 
-                auto it = visited.find(child_hash);
-                if (it != end(visited) && it->second->prog.size() <= child.prog.size()) {
+                auto it = tree.visited.find(child_hash);
+                if (it != end(tree.visited) && tree.payload[it->second].length <= child.prog.size()) {
                     continue;
                 }
 
                 memo.add(child.prog, child);
 
-                if (search_tree.size() < tree_max_size) {
-                    node child_node = {
-                        child_hash,         // .board_hash
-                        0,                  // .visits
-                        0,                  // .acc_score
-                        selected,           // .parent
-                        {nullptr},          // .children
-                        child.prog,         // .prog
-                        0,                  // .explored
-                    };
-
-                    search_tree.push_back(child_node);
-                    auto& n = search_tree.back();
-                    selected->children.push_back(&n);
-
-                    visited[child_hash] = &n;
-                }
+                mc_step step = {
+                    program_t(begin(child.prog) + selected_state.prog.size(), end(child.prog)),
+                    u32(child.prog.size()),
+                };
+
+                tree.add(selected, child_hash, step);
             }
 
             // simulate
             // logger << "simulate\n";
-            auto deep_state = mc_dive(map, selected_state, cancelled);
+            auto deep_state = mc_dive(map, selected_state, deadline, budget, best.sim.score);
             score = deep_state.sim.score;
 
             if (score > best.sim.score) {
                 best = deep_state;
+                checkpoint.offer(best.prog, best.sim.score);
                 // logger << "best update: " << best_score << " " << best_state.prog << endl;
             }
         }
 
         // backprop
         // logger << "backprop\n";
-        for (auto n = selected; n != nullptr; n = n->parent) {
-            n->acc_score += score;
-            n->visits++;
-        }
+        tree.backprop(selected, score);
     }
 
     return best;
@@ -697,11 +1330,13 @@ typedef struct plan_search_graph {
     const map_info& map;
     const Node& initial;
     const Location root;
+    const deadline_t& deadline;
+    time_budget& budget;
     unordered_map<Location, Node> tree;
     unordered_set<u64> visited;
 
-    plan_search_graph(const map_info& map, const Node& initial) :
-        map(map), initial(initial), root(initial.sim.board_hash) {
+    plan_search_graph(const map_info& map, const Node& initial, const deadline_t& deadline, time_budget& budget) :
+        map(map), initial(initial), root(initial.sim.board_hash), deadline(deadline), budget(budget) {
 
         tree[root] = initial;
     }
@@ -747,12 +1382,14 @@ typedef struct plan_search_graph {
 
         vector<Location> res;
 
-        // auto tm = timelimit / (map.lambdas_total * map.lambdas_total * map.lambdas_total + 2);
-        r64 tm = 0.1;
-        u8 cancelled = 0; // TODO:
+        auto tm = deadline.timeleft() / (map.lambdas_total - parent.sim.lambdas_collected + 2);
 
-        for (auto child : plan_children(map, parent, tm, cancelled)) {
+        for (auto child : plan_children(map, parent, deadline.slice(tm), budget)) {
             // logger << "  child " << child.sim.robot_pos << " " << child.prog << endl;
+            if (!child.sim.is_ended && analyse_reach(map, child.sim).is_unwinnable()) {
+                continue;
+            }
+
             auto loc = child.sim.board_hash;
             if (visited.find(loc) == end(visited)) {
                 tree[loc] = child;
@@ -806,16 +1443,16 @@ typedef struct plan_search_graph {
 
 
 search_state static inline
-player_astar(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
-    auto started = appclock::now();
+player_astar(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
 
     auto best = initialState;
 
-    plan_search_graph gen(map, initialState);
+    plan_search_graph gen(map, initialState, deadline, budget);
     auto goal_state = gen.stub_node(map.lift_pos);
 
     astar::search<plan_search_graph> find_path(gen);
-    auto path = find_path(gen.root, goal_state, timelimit);
+    auto path = find_path(gen.root, goal_state, deadline);
 
     if (path.size() > 0) {
         return gen.tree[path.back()];
@@ -825,6 +1462,190 @@ player_astar(const map_info& map, const search_state& initialState, const r64 ti
 }
 
 
+static constexpr u32 tour_far = 1 << 20;
+static constexpr u32 tour_weight = 4;
+static constexpr r64 tour_time_share = 0.2;
+
+
+typedef vector<vector<u32>> distance_matrix;
+
+
+// walking distances between the robot, every reachable lambda and the lift,
+// with rocks that can still move treated as passable
+distance_matrix static
+tour_distances(const map_info& map, const sim_state& sim, const vector<pos>& points) {
+    auto frozen = frozen_rocks(map, sim.board);
+    distance_matrix res(points.size(), vector<u32>(points.size(), tour_far));
+
+    for (size_t i = 0; i < points.size(); i++) {
+        auto distance = flood_distances(map, sim.board, frozen, points[i]);
+        for (size_t j = 0; j < points.size(); j++) {
+            auto d = distance[points[j].y * map.width + points[j].x];
+            res[i][j] = d == unreachable ? tour_far : d;
+        }
+    }
+
+    return res;
+}
+
+
+// open path from seq.front() to seq.back() through all points, both ends fixed
+void static
+tour_improve(const distance_matrix& d, vector<u32>& seq, const deadline_t& deadline) {
+    auto n = seq.size();
+
+    for (u8 improved = 1; improved && !deadline.expired(); ) {
+        improved = 0;
+
+        // 2-opt
+        for (size_t i = 1; i + 1 < n; i++) {
+            for (size_t j = i + 1; j + 1 < n; j++) {
+                s32 delta = s32(d[seq[i - 1]][seq[j]]) + d[seq[i]][seq[j + 1]] -
+                    d[seq[i - 1]][seq[i]] - d[seq[j]][seq[j + 1]];
+                if (delta < 0) {
+                    reverse(begin(seq) + i, begin(seq) + j + 1);
+                    improved = 1;
+                }
+            }
+        }
+
+        // or-opt, segments of up to three points
+        for (size_t len = 1; len <= 3; len++) {
+            for (size_t i = 1; i + len < n; i++) {
+                auto a = seq[i];
+                auto b = seq[i + len - 1];
+                s32 removed = s32(d[seq[i - 1]][a]) + d[b][seq[i + len]] - d[seq[i - 1]][seq[i + len]];
+
+                for (size_t j = 0; j + 1 < n; j++) {
+                    if (j + 1 >= i && j < i + len) {
+                        continue;
+                    }
+                    s32 added = s32(d[seq[j]][a]) + d[b][seq[j + 1]] - d[seq[j]][seq[j + 1]];
+                    if (added < removed) {
+                        vector<u32> segment(begin(seq) + i, begin(seq) + i + len);
+                        seq.erase(begin(seq) + i, begin(seq) + i + len);
+                        auto at = j < i ? j + 1 : j + 1 - len;
+                        seq.insert(begin(seq) + at, begin(segment), end(segment));
+                        improved = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+vector<pos> static
+plan_tour(const map_info& map, const sim_state& sim, const deadline_t& deadline) {
+    auto reach = analyse_reach(map, sim);
+
+    vector<pos> points = {sim.robot_pos};
+    for (coord row = 0; row < map.height; row++) {
+        for (coord col = 0; col < map.width; col++) {
+            coosq offset = row * map.width + col;
+            if (sim.board[offset] == cell::lambda && reach.reachable(offset)) {
+                points.push_back({col, row});
+            }
+        }
+    }
+    points.push_back(map.lift_pos);
+
+    auto d = tour_distances(map, sim, points);
+
+    if (!reach.lift_reachable) {
+        for (auto& row : d) {
+            row.back() = 0;
+        }
+    }
+
+    // nearest neighbour
+    vector<u32> seq = {0};
+    vector<u8> used(points.size(), 0);
+    used[0] = used[points.size() - 1] = 1;
+
+    for (size_t k = 2; k < points.size(); k++) {
+        u32 best = 0;
+        for (u32 j = 1; j + 1 < points.size(); j++) {
+            if (!used[j] && (best == 0 || d[seq.back()][j] < d[seq.back()][best])) {
+                best = j;
+            }
+        }
+        used[best] = 1;
+        seq.push_back(best);
+    }
+
+    seq.push_back(points.size() - 1);
+
+    tour_improve(d, seq, deadline);
+
+    vector<pos> order;
+    for (size_t i = 1; i + 1 < seq.size(); i++) {
+        order.push_back(points[seq[i]]);
+    }
+
+    return order;
+}
+
+
+// walk the tour leg by leg, putting off lambdas that cannot be reached yet
+search_state static
+follow_tour(const map_info& map, const search_state& initialState, const vector<pos>& order,
+    const deadline_t& deadline, time_budget& budget) {
+
+    auto state = initialState;
+    deque<pos> pending(begin(order), end(order));
+    size_t failures = 0;
+
+    while (!pending.empty() && failures < pending.size() && !deadline.expired()) {
+        auto goal = pending.front();
+        pending.pop_front();
+
+        if (state.sim.board[goal.y * map.width + goal.x] != cell::lambda) {
+            continue;
+        }
+
+        auto tm = deadline.timeleft() / (pending.size() + 2);
+        auto next = find_path(map, state, goal, deadline.slice(tm), budget);
+
+        if (next.sim.robot_pos != goal || (next.sim.is_ended && !next.is_win)) {
+            pending.push_back(goal);
+            failures++;
+            continue;
+        }
+
+        state = next;
+        failures = 0;
+    }
+
+    if (!state.sim.is_ended && state.sim.lambdas_collected == map.lambdas_total) {
+        auto exit = find_path(map, state, map.lift_pos, deadline, budget);
+        if (exit.is_win) {
+            state = exit;
+        }
+    }
+
+    return state;
+}
+
+
+search_state static inline
+player_tour(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
+
+    auto order = plan_tour(map, initialState.sim, deadline);
+    budget.set_tour(order);
+
+    auto state = follow_tour(map, initialState, order, deadline, budget);
+    state.sim = runsim(map, initialState.sim, state.prog);
+
+    logger << "tour: " << order.size() << " lambdas, score " << state.sim.score << endl;
+
+    checkpoint.offer(state.prog, state.sim.score);
+    return state;
+}
+
+
 typedef struct distance_order {
     pos origin;
 
@@ -836,38 +1657,48 @@ typedef struct distance_order {
 
 
 search_state static inline
-player_rand(const map_info& map, const search_state& initialState, const r64 timelimit, const u8& cancelled) {
-    auto started = appclock::now();
+player_rand(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget, const vector<u8>* mask = nullptr, const search_state* incumbent = nullptr) {
 
-    auto best = initialState;
+    auto best = incumbent != nullptr ? *incumbent : initialState;
     u64 dives = 0;
 
-    while (!cancelled) {
-        auto now = appclock::now();
-        chrono::duration<r64> elapsed = now - started;
-        auto timeleft = timelimit - elapsed.count();
-        if (timeleft <= 0) {
-            break;
-        }
-
-        auto tm = timeleft / 4;
+    while (!deadline.expired()) {
+        auto tm = deadline.timeleft() / 4;
 
         #if 0
-        auto state = mc_dive(map, initialState, cancelled);
+        auto state = mc_dive(map, initialState, deadline, budget, best.sim.score);
 
         #else
         auto state = initialState;
         // logger << "dive " << dives << " pos " << state.sim.robot_pos << endl;
 
-        unordered_set<u64> visited;
+        arena dive;
+        arena_set<u64> visited(dive);
         visited.insert(state.sim.board_hash);
 
-        while (!state.sim.is_ended && !cancelled) {
+        while (!state.sim.is_ended && !deadline.expired()) {
+            if (score_bound(map, state.sim) <= best.sim.score) {
+                break;
+            }
+
             unordered_set<pos> exclude;
 
+            update_goals(map, state);
             auto goals = plan_goals(map, state);
 
-            while (!cancelled) {
+            if (mask != nullptr) {
+                for (auto it = begin(goals); it != end(goals); ) {
+                    if ((*mask)[it->y * map.width + it->x]) {
+                        it++;
+                    }
+                    else {
+                        it = goals.erase(it);
+                    }
+                }
+            }
+
+            while (!deadline.expired()) {
                 goals = _difference(goals, exclude);
 
                 if (goals.empty()) {
@@ -904,11 +1735,21 @@ player_rand(const map_info& map, const search_state& initialState, const r64 tim
                 }
                 #endif
 
+                if (!budget.tour.empty()) {
+                    auto next = min_element(begin(goals), end(goals), [&budget](const pos& a, const pos& b) {
+                        return budget.tour_rank(a) < budget.tour_rank(b);
+                    });
+                    if (budget.tour_rank(*next) < budget.tour.size()) {
+                        goalsvec.insert(end(goalsvec), tour_weight, *next);
+                    }
+                }
+
                 auto goal = *random_choice(begin(goalsvec), end(goalsvec));
                 // logger << "  picked " << goal << endl;
 
+                auto gain = goal_gain(map, state, goal);
                 auto nextState = (goal == state.sim.robot_pos) ? advance_search(map, state, action::wait) :
-                    find_path(map, state, goal, 1.0, cancelled);
+                    find_path(map, state, goal, deadline.slice(budget.allot(goal, gain, tm, gain)), budget);
                 // logger << "    find_path: " << nextState.sim.robot_pos << endl;
                 if (nextState.sim.robot_pos != goal || visited.find(nextState.sim.board_hash) != end(visited)) {
                     // logger << "    exclude " << goal << endl;
@@ -928,6 +1769,7 @@ player_rand(const map_info& map, const search_state& initialState, const r64 tim
 
         if (state.sim.score > best.sim.score) {
             best = state;
+            checkpoint.offer(best.prog, best.sim.score);
         }
     }
 
@@ -936,8 +1778,126 @@ player_rand(const map_info& map, const search_state& initialState, const r64 tim
 }
 
 
+// tour first, then random dives that have to beat it
+search_state static inline
+player_toured(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
+
+    auto toured = player_tour(map, initialState, deadline.slice(deadline.timeleft() * tour_time_share), budget);
+    return player_rand(map, initialState, deadline, budget, nullptr, &toured);
+}
+
+
+typedef s32 (*beam_eval_t)(const map_info&, const search_state&);
+
+
+s32 static inline
+beam_eval(const map_info& map, const search_state& state) {
+    if (state.sim.is_ended) {
+        return state.sim.score;
+    }
+
+    auto lift_distance = manhattan_distance(state.sim.robot_pos, map.lift_pos);
+    auto lambdas_left = map.lambdas_total - state.sim.lambdas_collected;
+
+    return state.sim.score + 25 * state.sim.lambdas_collected - lift_distance - lambdas_left;
+}
+
+
+static constexpr size_t beam_min_width = 4;
+static constexpr size_t beam_max_width = 4096;
+
+
+search_state static inline
+player_beam(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget, beam_eval_t eval = beam_eval) {
+
+    auto best = initialState;
+
+    size_t workers = max(thread::hardware_concurrency(), 1u);
+    size_t width = beam_min_width * workers;
+
+    vector<search_state> beam = {initialState};
+    unordered_set<u64> seen = {initialState.sim.board_hash};
+
+    while (!beam.empty() && !deadline.expired()) {
+        auto started = appclock::now();
+
+        auto lambdas_left = map.lambdas_total - beam.front().sim.lambdas_collected;
+        auto steps_left = lambdas_left + 2;
+        auto rounds = (beam.size() + workers - 1) / workers;
+        auto tm = deadline.timeleft() / steps_left / rounds;
+
+        vector<vector<search_state>> expanded(beam.size());
+        vector<thread> pool;
+
+        for (size_t worker = 0; worker < min(workers, beam.size()); worker++) {
+            pool.push_back(thread([&, worker] () {
+                for (size_t i = worker; i < beam.size(); i += workers) {
+                    expanded[i] = plan_children(map, beam[i], deadline.slice(tm), budget);
+                }
+            }));
+        }
+
+        for (auto& t : pool) {
+            t.join();
+        }
+
+        unordered_map<u64, search_state> level;
+
+        for (auto& children : expanded) {
+            for (auto& child : children) {
+                if (child.sim.score > best.sim.score) {
+                    best = child;
+                    checkpoint.offer(best.prog, best.sim.score);
+                }
+
+                auto hash = child.sim.board_hash;
+
+                if (child.sim.is_ended || seen.find(hash) != end(seen)) {
+                    continue;
+                }
+
+                auto it = level.find(hash);
+                if (it == end(level) || it->second.sim.score < child.sim.score) {
+                    level[hash] = move(child);
+                }
+            }
+        }
+
+        vector<pair<s32, search_state*>> ranked;
+        ranked.reserve(level.size());
+
+        for (auto& x : level) {
+            ranked.push_back(make_pair(eval(map, x.second), &x.second));
+        }
+
+        chrono::duration<r64> elapsed = appclock::now() - started;
+        auto state_cost = elapsed.count() / max(rounds, size_t(1));
+        auto affordable = deadline.timeleft() / max(state_cost * steps_left, 1e-6) * workers;
+        width = max(beam_min_width, min(beam_max_width, size_t(affordable)));
+
+        auto keep = min(width, ranked.size());
+        partial_sort(begin(ranked), begin(ranked) + keep, end(ranked),
+            [](const pair<s32, search_state*>& a, const pair<s32, search_state*>& b) {
+                return a.first > b.first;
+            });
+
+        beam.clear();
+
+        for (size_t i = 0; i < keep; i++) {
+            auto state = ranked[i].second;
+            seen.insert(state->sim.board_hash);
+            beam.push_back(move(*state));
+        }
+    }
+
+    return best;
+}
+
+
 program_t static inline
-player(const game_state& game, const r64 timelimit, const u8& cancelled) {
+player(const game_state& game, const deadline_t& deadline) {
     auto& map = getmap(game);
     auto& sim = getsim(game);
 
@@ -947,9 +1907,12 @@ player(const game_state& game, const r64 timelimit, const u8& cancelled) {
         program_t(),
     };
 
-    // state = player_bfs(map, state, timelimit, cancelled);
-    // state = player_mc(map, state, timelimit, cancelled);
-    state = player_rand(map, state, timelimit, cancelled);
+    time_budget budget(deadline);
+
+    // state = player_bfs(map, state, deadline, budget);
+    // state = player_mc(map, state, deadline, budget);
+    // state = player_beam(map, state, deadline, budget);
+    state = player_toured(map, state, deadline, budget);
 
     return state.prog;
 }
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+namespace paiv {
+namespace regions {
+
+
+using pl::search_state;
+using pl::time_budget;
+
+
+static constexpr s32 no_region = -1;
+static constexpr size_t region_min_cells = 48 * 48;
+static constexpr r64 region_time_share = 0.5;
+static constexpr r64 region_solve_share = 0.6;
+static constexpr r64 region_extend_share = 0.5;
+
+
+typedef struct region_info {
+    vector<coosq> cells;
+    vector<coosq> doors;
+    u32 lambdas;
+    u8 independent;
+} region_info;
+
+
+typedef struct region_map {
+    vector<s32> id;
+    vector<region_info> regions;
+} region_map;
+
+
+typedef struct region_plan {
+    s32 region;
+    pos entry;
+    program_t prog;
+} region_plan;
+
+
+u8 static inline
+_is_open(const cell x) {
+    switch (x) {
+        case cell::empty:
+        case cell::earth:
+        case cell::lambda:
+        case cell::rock:
+        case cell::robot:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+// rooms are split at one-cell-wide passages
+u8 static inline
+_is_door(const map_info& map, const board_t& board, const coord col, const coord row) {
+    auto closed = [&] (const coord x, const coord y) {
+        return x < 0 || x >= map.width || y < 0 || y >= map.height || !_is_open(board[y * map.width + x]);
+    };
+
+    return _is_open(board[row * map.width + col]) &&
+        ((closed(col - 1, row) && closed(col + 1, row)) || (closed(col, row - 1) && closed(col, row + 1)));
+}
+
+
+region_map static
+analyse(const map_info& map, const sim_state& sim) {
+    const auto& board = sim.board;
+    auto stride = map.width;
+
+    region_map res = {vector<s32>(board.size(), no_region), {}};
+    vector<u8> doors(board.size(), 0);
+
+    for (coord row = 0; row < map.height; row++) {
+        for (coord col = 0; col < map.width; col++) {
+            doors[row * stride + col] = _is_door(map, board, col, row);
+        }
+    }
+
+    static const pos neighbours[] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+    for (coosq start = 0; start < board.size(); start++) {
+        if (!_is_open(board[start]) || doors[start] || res.id[start] != no_region) {
+            continue;
+        }
+
+        s32 id = res.regions.size();
+        res.regions.push_back({{start}, {}, 0, 1});
+        res.id[start] = id;
+
+        auto& cells = res.regions.back().cells;
+
+        for (size_t i = 0; i < cells.size(); i++) {
+            auto offset = cells[i];
+            coord col = offset % stride;
+            coord row = offset / stride;
+
+            if (board[offset] == cell::lambda) {
+                res.regions.back().lambdas++;
+            }
+
+            for (auto& d : neighbours) {
+                coord x = col + d.x;
+                coord y = row + d.y;
+
+                if (x < 0 || x >= map.width || y < 0 || y >= map.height) {
+                    continue;
+                }
+
+                coosq next = y * stride + x;
+
+                if (!_is_open(board[next]) || res.id[next] != no_region) {
+                    continue;
+                }
+
+                if (doors[next]) {
+                    auto& rd = res.regions.back().doors;
+                    if (find(begin(rd), end(rd), next) == end(rd)) {
+                        rd.push_back(next);
+                    }
+                    continue;
+                }
+
+                res.id[next] = id;
+                cells.push_back(next);
+            }
+        }
+    }
+
+    // a region is independent if its rocks are at rest and none of them touch a door
+    auto settled = simulator_step(map, sim, action::wait);
+
+    for (coosq offset = 0; offset < board.size(); offset++) {
+        if (settled.board[offset] != board[offset] && res.id[offset] != no_region) {
+            res.regions[res.id[offset]].independent = 0;
+        }
+    }
+
+    for (auto& r : res.regions) {
+        for (auto door : r.doors) {
+            coord col = door % stride;
+            coord row = door / stride;
+
+            for (coord y = max(0, row - 1); y <= min(map.height - 1, row + 1); y++) {
+                for (coord x = max(0, col - 1); x <= min(map.width - 1, col + 1); x++) {
+                    if (board[y * stride + x] == cell::rock) {
+                        r.independent = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    return res;
+}
+
+
+search_state static
+_enter(const map_info& map, const search_state& initialState, const pos& entry) {
+    auto state = initialState;
+    auto& sim = state.sim;
+
+    sim.board[sim.robot_pos.y * map.width + sim.robot_pos.x] = cell::empty;
+    sim.board[entry.y * map.width + entry.x] = cell::robot;
+    sim.board_hash = board_hash(sim.board);
+    sim.robot_pos = entry;
+
+    return state;
+}
+
+
+// solve every independent region from its nearest door, spread over hardware threads
+vector<region_plan> static
+solve_regions(const map_info& map, const search_state& initialState, const region_map& rmap,
+    const deadline_t& deadline, time_budget& budget) {
+
+    const auto& sim = initialState.sim;
+    auto reach = analyse_reach(map, sim);
+    auto robot = sim.robot_pos.y * map.width + sim.robot_pos.x;
+
+    vector<region_plan> plans;
+
+    for (s32 id = 0; id < s32(rmap.regions.size()); id++) {
+        const auto& r = rmap.regions[id];
+
+        if (!r.independent || r.lambdas == 0) {
+            continue;
+        }
+
+        if (rmap.id[robot] == id) {
+            plans.push_back({id, sim.robot_pos, {}});
+            continue;
+        }
+
+        coosq entry = 0;
+        u32 distance = unreachable;
+
+        for (auto door : r.doors) {
+            auto x = sim.board[door];
+            if ((x == cell::empty || x == cell::earth) && reach.distance[door] < distance) {
+                entry = door;
+                distance = reach.distance[door];
+            }
+        }
+
+        if (distance != unreachable) {
+            plans.push_back({id, {coord(entry % map.width), coord(entry / map.width)}, {}});
+        }
+    }
+
+    size_t workers = max(thread::hardware_concurrency(), 1u);
+    size_t rounds = (plans.size() + workers - 1) / max(workers, size_t(1));
+    auto tm = deadline.timeleft() / max(rounds, size_t(1));
+
+    atomic<size_t> next(0);
+    vector<thread> pool;
+
+    for (size_t worker = 0; worker < min(workers, plans.size()); worker++) {
+        pool.push_back(thread([&] () {
+            checkpoint_mute mute;
+
+            for (size_t i = next++; i < plans.size(); i = next++) {
+                auto& plan = plans[i];
+
+                vector<u8> mask(sim.board.size(), 0);
+                for (auto offset : rmap.regions[plan.region].cells) {
+                    mask[offset] = sim.board[offset] != cell::lift;
+                }
+
+                auto start = plan.entry == sim.robot_pos ? initialState : _enter(map, initialState, plan.entry);
+                start.prog.clear();
+
+                auto res = pl::player_rand(map, start, deadline.slice(tm), budget, &mask);
+                plan.prog = res.prog;
+            }
+        }));
+    }
+
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    return plans;
+}
+
+
+// walk from region to region, replaying each region's own program from its door
+search_state static
+stitch(const map_info& map, const search_state& initialState, vector<region_plan> plans,
+    const deadline_t& deadline, time_budget& budget) {
+
+    auto state = initialState;
+
+    while (!plans.empty() && !deadline.expired()) {
+        auto nearest = min_element(begin(plans), end(plans), [&] (const region_plan& a, const region_plan& b) {
+            return manhattan_distance(a.entry, state.sim.robot_pos) < manhattan_distance(b.entry, state.sim.robot_pos);
+        });
+
+        auto plan = *nearest;
+        plans.erase(nearest);
+
+        auto next = state;
+
+        if (next.sim.robot_pos != plan.entry) {
+            auto tm = deadline.timeleft() / (plans.size() + 2);
+            next = pl::find_path(map, state, plan.entry, deadline.slice(tm), budget);
+            if (next.sim.robot_pos != plan.entry) {
+                continue;
+            }
+        }
+
+        for (auto mv : plan.prog) {
+            if (next.sim.is_ended) {
+                break;
+            }
+            next = pl::advance_search(map, next, mv);
+        }
+
+        if (next.sim.is_ended && !next.is_win) {
+            continue;
+        }
+
+        state = next;
+    }
+
+    if (!state.sim.is_ended && state.sim.lambdas_collected == map.lambdas_total) {
+        auto exit = pl::find_path(map, state, map.lift_pos, deadline, budget);
+        if (exit.is_win) {
+            state = exit;
+        }
+    }
+
+    return state;
+}
+
+
+search_state static inline
+player_regions(const map_info& map, const search_state& initialState, const deadline_t& deadline,
+    time_budget& budget) {
+
+    if (size_t(map.width * map.height) < region_min_cells) {
+        return pl::player_toured(map, initialState, deadline, budget);
+    }
+
+    auto rmap = analyse(map, initialState.sim);
+
+    auto solvable = count_if(begin(rmap.regions), end(rmap.regions), [] (const region_info& r) {
+        return r.independent && r.lambdas > 0;
+    });
+
+    if (solvable < 2) {
+        return pl::player_toured(map, initialState, deadline, budget);
+    }
+
+    logger << "regions: " << rmap.regions.size() << ", independent: " << solvable << endl;
+
+    auto region_deadline = deadline.slice(deadline.timeleft() * region_time_share);
+
+    auto plans = solve_regions(map, initialState, rmap, region_deadline.slice(region_deadline.timeleft() * region_solve_share), budget);
+    auto stitched = stitch(map, initialState, plans, region_deadline, budget);
+
+    auto extended = stitched;
+    if (!stitched.sim.is_ended) {
+        extended = pl::player_rand(map, stitched, deadline.slice(deadline.timeleft() * region_extend_share), budget);
+    }
+
+    auto fresh = pl::player_toured(map, initialState, deadline, budget);
+
+    search_state best = initialState;
+    s32 best_score = runsim(map, initialState.sim, best.prog).score;
+
+    for (auto x : {&stitched, &extended, &fresh}) {
+        auto score = runsim(map, initialState.sim, x->prog).score;
+        checkpoint.offer(x->prog, score);
+        if (score > best_score) {
+            best = *x;
+            best_score = score;
+        }
+    }
+
+    logger << "stitched: " << runsim(map, initialState.sim, stitched.prog).score <<
+        ", extended: " << runsim(map, initialState.sim, extended.prog).score <<
+        ", fresh: " << runsim(map, initialState.sim, fresh.prog).score << endl;
+
+    return best;
+}
+
+
+program_t static inline
+player(const game_state& game, const deadline_t& deadline) {
+    auto& map = getmap(game);
+    auto& sim = getsim(game);
+
+    search_state state = {
+        sim,
+        sim.robot_pos == map.lift_pos,
+        program_t(),
+    };
+
+    time_budget budget(deadline);
+
+    state = player_regions(map, state, deadline, budget);
+
+    return state.prog;
+}
+
+
+} // namespace regions
+}
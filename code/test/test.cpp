@@ -1,7 +1,11 @@
 #include <cassert>
+#include <csignal>
+#include <cstdlib>
 #include <string>
 #include <sstream>
+#include <unistd.h>
 #include "../src/common.cpp"
+#include "../src/solver.cpp"
 
 
 namespace paiv {
@@ -14,6 +18,76 @@ read_map(const string& s) {
 }
 
 
+// the spec maps under MAPS_DIR; fails rather than pass vacuously when none of them loads
+template<typename Visit>
+void static
+for_each_spec_map(Visit visit) {
+    size_t loaded = 0;
+
+    for (auto name : {"sample/contest", "full/full", "lightning/lightning"}) {
+        for (u32 i = 1; i <= 10; i++) {
+            ifstream si(MAPS_DIR "/" + string(name) + to_string(i) + ".map");
+            if (!si) {
+                continue;
+            }
+
+            auto m = read_map(si);
+            loaded++;
+            visit(m);
+        }
+    }
+
+    assert(loaded > 0);
+}
+
+
+sim_state static inline&
+_walk_sim(sim_state& state) {
+    return state;
+}
+
+
+sim_state static inline&
+_walk_sim(pl::search_state& state) {
+    return state.sim;
+}
+
+
+void static inline
+_walk_make(const map_info& map, sim_state& state, const action mv) {
+    simulator_make(map, state, mv);
+}
+
+
+void static inline
+_walk_make(const map_info& map, pl::search_state& state, const action mv) {
+    state = pl::advance_search(map, state, mv);
+}
+
+
+// visits every board of a random walk of legal moves on each spec map
+template<typename State = sim_state, typename Visit>
+void static
+for_each_spec_walk(mt19937& rng, const u32 steps, Visit visit) {
+    for_each_spec_map([&] (const game_state& m) {
+        auto& map = getmap(m);
+        State state;
+        _walk_sim(state) = getsim(m);
+
+        for (u32 step = 0; step < steps && !_walk_sim(state).is_ended; step++) {
+            visit(map, state);
+
+            auto moves = legal_moves(map, _walk_sim(state), {});
+            if (moves.empty()) {
+                break;
+            }
+            uniform_int_distribution<size_t> distr(0, moves.size() - 1);
+            _walk_make(map, state, moves[distr(rng)]);
+        }
+    });
+}
+
+
 void
 test_map_reader() {
     {
@@ -183,12 +257,894 @@ test_sim() {
 }
 
 
+void
+test_make_unmake() {
+    {
+        auto m = read_map("#######\n#  *  #\n# *\\* #\n#.R\\ .#\n###L###");
+        auto& map = getmap(m);
+        auto state = getsim(m);
+        undo_t undo;
+
+        for (auto mv : read_program("LRRUDWL")) {
+            auto expected = simulator_step(map, state, mv);
+            auto before = state;
+
+            simulator_make(map, state, mv, &undo);
+            assert(state.board == expected.board);
+            assert(state.board_hash == expected.board_hash);
+            assert(state.score == expected.score);
+
+            simulator_unmake(state, undo);
+            assert(state.board == before.board);
+            assert(state.board_hash == before.board_hash);
+            assert(state.robot_pos == before.robot_pos);
+            assert(state.score == before.score);
+
+            state = expected;
+        }
+    }
+}
+
+
+void
+test_find_path_ida() {
+    {
+        auto m = read_map("######\n#. *R#\n#  \\.#\n#\\ * #\nL  .\\#\n######");
+        auto& map = getmap(m);
+        pl::search_state initial = {getsim(m), 0, {}};
+
+        u8 cancelled = 0;
+        deadline_t deadline(cancelled, 1.0);
+        pl::time_budget budget(deadline);
+
+        auto a = pl::find_path(map, initial, {4,4}, deadline, budget);
+        auto b = pl::find_path_ida(map, initial, {4,4}, deadline, 64 * 1024);
+
+        assert(b.sim.robot_pos == pos({4,4}));
+        assert(b.prog.size() == a.prog.size());
+        assert(runsim(map, initial.sim, b.prog, runsim_opts::no_abort).robot_pos == pos({4,4}));
+    }
+}
+
+
+void static
+test_find_path_static() {
+    {
+        auto m = read_map("#######\n#R. ..#\n#.#.#.#\n#.. .\\#\n#####L#");
+        auto& map = getmap(m);
+        pl::search_state initial = {getsim(m), 0, {}};
+
+        auto state = pl::find_path_static(map, initial, {5, 3});
+        assert(state.sim.robot_pos == pos({5, 3}));
+        assert(state.prog.size() == 6);
+        assert(runsim(map, initial.sim, state.prog, runsim_opts::no_abort).robot_pos == pos({5, 3}));
+    }
+    {
+        auto m = read_map("#####\n#R*.#\n#. .#\n#..\\#\n###L#");
+        auto& map = getmap(m);
+        pl::search_state initial = {getsim(m), 0, {}};
+
+        auto state = pl::find_path_static(map, initial, {2, 2});
+        assert(state.sim.robot_pos != pos({2, 2}));
+
+        state = pl::find_path_static(map, initial, {2, 3});
+        assert(state.sim.robot_pos == pos({2, 3}));
+        assert(!state.sim.is_ended);
+    }
+}
+
+
+void static
+test_goal_set() {
+    mt19937 rng(11);
+
+    for_each_spec_walk<pl::search_state>(rng, 200, [] (const map_info& map, pl::search_state& state) {
+        // a kept set lists the cells changed on the way to the current board
+        auto& gs = state.goals;
+        assert(gs.goals.empty() || gs.changed_hash == state.sim.board_hash ||
+            (gs.changed.empty() && gs.board_hash == state.sim.board_hash));
+
+        pl::update_goals(map, state);
+
+        pl::goal_set fresh;
+        pl::update_goals(map, state.sim.board, state.sim.board_hash, fresh);
+        assert(fresh.goals == state.goals.goals);
+        assert(fresh.waiting == state.goals.waiting);
+
+        pl::search_state cold = {state.sim, state.is_win, state.prog};
+        assert(pl::plan_goals(map, cold) == pl::plan_goals(map, state));
+    });
+}
+
+
+void static
+test_goal_scan() {
+    #ifdef __SSE2__
+    mt19937 rng(13);
+
+    for_each_spec_walk(rng, 50, [] (const map_info& map, const sim_state& state) {
+        pl::goal_set a;
+        pl::goal_set b;
+        pl::_scan_goals_scalar(map, state.board, a);
+        pl::_scan_goals_sse2(map, state.board, b);
+
+        assert(a.goals == b.goals);
+        assert(a.waiting == b.waiting);
+    });
+    #endif
+}
+
+
+// timings only mean something in an optimized build
+void static
+bench_goal_scan() {
+    #if defined(__SSE2__) && defined(NDEBUG)
+    mt19937 rng(13);
+    r64 scalar_time = 0;
+    r64 packed_time = 0;
+    u32 scans = 0;
+
+    for_each_spec_walk(rng, 50, [&] (const map_info& map, const sim_state& state) {
+        pl::goal_set a;
+        pl::goal_set b;
+
+        auto started = appclock::now();
+        pl::_scan_goals_scalar(map, state.board, a);
+        auto middle = appclock::now();
+        pl::_scan_goals_sse2(map, state.board, b);
+        auto finished = appclock::now();
+
+        chrono::duration<r64> ta = middle - started;
+        chrono::duration<r64> tb = finished - middle;
+        scalar_time += ta.count();
+        packed_time += tb.count();
+        scans++;
+    });
+
+    clog << "goal scan, " << scans << " boards: scalar " << scalar_time * 1e6 / scans <<
+        " us, sse2 " << packed_time * 1e6 / scans << " us" << endl;
+    #endif
+}
+
+
+void static
+test_legal_mask() {
+    mt19937 rng(17);
+
+    for_each_spec_walk(rng, 200, [] (const map_info& map, const sim_state& state) {
+        auto mask = legal_mask(map, state, 0);
+        assert(legal_mask(map, state, map.width * map.height) == 0);
+
+        for (auto mv : all_actions) {
+            auto next = simulator_step(map, state, mv);
+            u8 moved = mv == action::wait || next.robot_pos != state.robot_pos;
+            assert(((mask & action_bit(mv)) != 0) == moved);
+        }
+
+        auto excluded = legal_mask(map, state, 0, action_bit(action::wait));
+        assert(excluded == (mask & ~action_bit(action::wait)));
+
+        auto mv = random_move(map, state, {});
+        assert(mask & action_bit(mv));
+    });
+}
+
+
+void
+test_fixed_board() {
+    mt19937 rng(23);
+    uniform_int_distribution<size_t> moves(0, array_len(all_actions) - 1);
+
+    for_each_spec_map([&] (const game_state& m) {
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+
+        if (sim.board.size() > inline_board_cells) {
+            return;
+        }
+
+        for (u32 k = 0; k < 20; k++) {
+            program_t prog;
+            for (u32 n = 0; n < 100; n++) {
+                prog.push_back(all_actions[moves(rng)]);
+            }
+
+            auto expected = _runsim(map, sim, prog, runsim_opts::force_abort, nullptr);
+            auto x = _runsim_fixed<inline_board_cells>(map, sim, prog, runsim_opts::force_abort);
+
+            assert(x.board == expected.board);
+            assert(x.board_hash == expected.board_hash);
+            assert(x.robot_pos == expected.robot_pos);
+            assert(x.score == expected.score);
+            assert(x.is_ended == expected.is_ended);
+            assert(runsim(map, sim, prog).score == expected.score);
+        }
+    });
+}
+
+
+void
+test_alloc() {
+    {
+        slab_allocator<u64> slab;
+        auto p = slab.allocate(5);
+        slab.deallocate(p, 5);
+        auto r = slab.allocate(5);
+        assert(r == p);
+        slab.deallocate(r, 5);
+
+        auto q = slab.allocate(7);
+        assert(q != p);
+        slab.deallocate(q, 7);
+    }
+
+    {
+        // a full size class frees the surplus instead of spilling into other lists
+        slab_cache cache = {};
+        cache.deallocate(cache.allocate(8), 8);
+
+        size_t size = slab_cache::cache_bytes / slab_cache::cache_min_blocks;
+        vector<void*> blocks;
+        for (size_t i = 0; i <= slab_cache::cache_min_blocks; i++) {
+            blocks.push_back(cache.allocate(size));
+        }
+        for (size_t i = 0; i < slab_cache::cache_min_blocks; i++) {
+            cache.deallocate(blocks[i], size);
+        }
+
+        auto small = cache.allocate(8);
+        cache.deallocate(blocks.back(), size);
+
+        size_t lists = 0;
+        for (auto& x : cache.slabs) {
+            if (x.size == size && x.head != nullptr) {
+                lists++;
+                assert(x.count == slab_cache::cache_min_blocks);
+            }
+        }
+        assert(lists == 1);
+        cache.deallocate(small, 8);
+        cache.release();
+    }
+
+    {
+        arena pool;
+        arena_set<u64> visited(pool);
+        for (u64 i = 0; i < 100000; i++) {
+            visited.insert(i * 2654435761u);
+        }
+        assert(visited.size() == 100000);
+        assert(visited.count(2654435761u) == 1);
+        assert(visited.count(1) == 0);
+
+        arena_allocator<char> bytes(pool);
+        arena_allocator<r64> reals(pool);
+        bytes.allocate(3);
+        auto x = reals.allocate(4);
+        assert(reinterpret_cast<size_t>(x) % alignof(r64) == 0);
+    }
+}
+
+
+void
+test_reach() {
+    {
+        auto m = read_map("####\n#  #\n# *#\n# *#\n#R #\n####");
+        auto& map = getmap(m);
+        auto frozen = frozen_rocks(map, getsim(m).board);
+        assert(frozen[3 * map.width + 2] == 0);
+    }
+    {
+        auto m = read_map("#####\n#  *#\n# *##\n#####");
+        auto& map = getmap(m);
+        auto frozen = frozen_rocks(map, getsim(m).board);
+        assert(frozen[2 * map.width + 2] == 1);
+        assert(frozen[1 * map.width + 3] == 1);
+    }
+    {
+        auto m = read_map("######\n#R.#\\#\n#..#*#\n#.\\.##\n##L###");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        auto reach = analyse_reach(map, sim);
+        assert(reach.lambdas_left == 2);
+        assert(reach.lambdas_reachable == 1);
+        assert(reach.lift_reachable);
+        assert(reach.is_unwinnable());
+        assert(!reach.is_dead());
+
+        pl::search_state state = {sim, 0, {}};
+        auto goals = pl::plan_goals(map, state);
+        assert(goals.find({4,1}) == end(goals));
+        assert(goals.find({2,3}) != end(goals));
+    }
+    {
+        auto m = read_map("######\n#R#\\L#\n###*##\n######");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        assert(analyse_reach(map, sim).is_dead());
+        assert(legal_moves(map, sim, {}).size() > 0);
+        assert(legal_moves(map, sim, {}, {}, 1).empty());
+
+        pl::search_state state = {sim, 0, {}};
+        assert(pl::plan_goals(map, state).empty());
+    }
+}
+
+
+void
+test_score_bound() {
+    {
+        auto m = read_map("#####\n#R\\L#\n#####");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        assert(score_bound(map, sim) == 73);
+        assert(runsim(map, sim, read_program("RR")).score == 73);
+    }
+    {
+        auto m = read_map("######\n#R#\\L#\n###*##\n######");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        assert(score_bound(map, sim) == sim.score);
+    }
+    {
+        ifstream si(MAPS_DIR "/sample/contest1.map");
+        auto m = read_map(si);
+        auto& map = getmap(m);
+        auto state = getsim(m);
+
+        u8 cancelled = 0;
+        deadline_t deadline(cancelled, 0.2);
+        auto prog = pl::player(m, deadline);
+        auto score = runsim(map, state, prog).score;
+
+        for (auto mv : prog) {
+            assert(score_bound(map, state) >= score);
+            state = simulator_step(map, state, mv);
+        }
+    }
+}
+
+
+void
+test_post_optimizer() {
+    auto m = read_map("########\n#R  \\ L#\n########");
+    auto& map = getmap(m);
+    auto& sim = getsim(m);
+
+    u8 cancelled = 0;
+    deadline_t deadline(cancelled, 1.0);
+
+    {
+        auto prog = opt::optimize(map, sim, read_program("RLWRRRRR"), deadline);
+        assert(prog == read_program("RRRRR"));
+        assert(runsim(map, sim, prog).score == 70);
+    }
+    {
+        auto prog = opt::optimize(map, sim, read_program("RRRLLL"), deadline);
+        assert(prog == read_program("RRRA"));
+        assert(runsim(map, sim, prog).score == 47);
+    }
+    {
+        auto prog = read_program("RLWLDRRRURRR");
+        auto score = runsim(map, sim, prog).score;
+        auto res = opt::anneal(map, sim, prog, deadline.slice(0.1));
+        assert(runsim(map, sim, res).score >= score);
+    }
+}
+
+
+void static
+test_time_budget() {
+    u8 cancelled = 0;
+    deadline_t deadline(cancelled, 10);
+    pl::time_budget budget(deadline);
+
+    auto near = [] (const r64 a, const r64 b) {
+        return fabs(a - b) < 1e-9;
+    };
+
+    pos a = {1, 1};
+    pos b = {2, 2};
+    pos c = {3, 3};
+
+    // no history yet, the pool is split by gain
+    assert(near(budget.allot(a, 25, 1.0, 50), 0.5));
+
+    for (u32 i = 0; i < 200; i++) {
+        budget.record(a, 0.01, 1, 0);
+    }
+
+    // capped at a few times the mean cost of a successful search
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.04));
+    assert(near(budget.allot(b, 5, 0.1, 50), 0.01));
+
+    // searches cut off by their slice raise the next one, within bounds
+    budget.record(b, 0.04, 0, 1);
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.08));
+    budget.record(b, 0.08, 0, 1);
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.16));
+
+    // a search that gave up before its slice ran out proves nothing about the time it needs
+    budget.record(b, 0.001, 0, 0);
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.16));
+
+    for (u32 i = 0; i < 3; i++) {
+        budget.record(b, 0.01, 0, 1);
+    }
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.64));
+    assert(near(budget.allot(b, 25, 1.0, 50), 0.5));
+    assert(near(budget.allot(a, 50, 1.0, 50), 0.04));
+
+    // once cut-off searches take too much of the total, retries fall back to the cap
+    budget.record(c, 1.0, 0, 1);
+    assert(near(budget.allot(b, 50, 1.0, 50), 0.04));
+
+    // a success resets the goal
+    budget.record(b, 0.01, 1, 0);
+    assert(budget.goals[b].missed == 0);
+}
+
+
+void
+test_genetic() {
+    {
+        auto prog = read_program("LRUDWLLLLRRRRUUUUDDDDWWWWA");
+        genetic::packed_program packed(prog);
+        assert(packed.size() == prog.size());
+        assert(packed.words.size() == 2);
+        assert(packed.unpack() == prog);
+    }
+    {
+        auto m = read_map("########\n#R  \\ L#\n########");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+
+        genetic::individual a = {genetic::packed_program(read_program("WRRRRRR")), 0, 0, 0};
+        genetic::individual b = {genetic::packed_program(read_program("RRRRR")), 0, 0, 0};
+        genetic::evaluate(map, sim, a);
+        genetic::evaluate(map, sim, b);
+        assert(a.score == 69);
+        assert(b.score == 70);
+        assert(a.evaluated && b.evaluated);
+
+        auto ta = genetic::trail(map, sim, a.prog);
+        auto tb = genetic::trail(map, sim, b.prog);
+        assert(ta.size() == 6);
+        assert(tb.size() == 5);
+
+        mt19937 rng(0);
+        genetic::packed_program child;
+        auto crossed = genetic::crossover(a, ta, b, tb, rng, child);
+        assert(crossed);
+        assert(child.size() == 6);
+        assert(runsim(map, sim, child.unpack()).score == 69);
+    }
+    {
+        // a generation in flight stops at the deadline, unevaluated children are dropped
+        ifstream si(MAPS_DIR "/sample/contest10.map");
+        auto m = read_map(si);
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+
+        u8 cancelled = 0;
+        static constexpr r64 timelimit = 0.3;
+        deadline_t deadline(cancelled, timelimit);
+        pl::time_budget budget(deadline);
+        pl::search_state initial = {sim, 0, {}};
+
+        auto started = appclock::now();
+        auto state = genetic::player_genetic(map, initial, deadline, budget);
+        chrono::duration<r64> elapsed = appclock::now() - started;
+
+        assert(elapsed.count() < timelimit + 0.02);
+        assert(runsim(map, sim, state.prog).score == state.sim.score);
+    }
+}
+
+
+void static
+test_nested() {
+    {
+        auto m = read_map("########\n#R  \\ L#\n########");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        pl::search_state initial = {sim, 0, {}};
+
+        u8 cancelled = 0;
+        {
+            deadline_t deadline(cancelled, 0.2);
+            pl::time_budget budget(deadline);
+            auto state = nested::player_nmcs(map, initial, deadline, budget);
+            assert(state.sim.score == 70);
+            assert(runsim(map, sim, state.prog, runsim_opts::no_abort).score == state.sim.score);
+        }
+        {
+            deadline_t deadline(cancelled, 0.2);
+            pl::time_budget budget(deadline);
+            auto state = nested::player_nrpa(map, initial, deadline, budget);
+            assert(state.sim.score == 70);
+            assert(runsim(map, sim, state.prog, runsim_opts::no_abort).score == state.sim.score);
+        }
+    }
+    {
+        // nothing beats the starting score, the level still plays out its first rollout
+        auto m = read_map("#######\n#R #\\L#\n#######");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        pl::search_state initial = {sim, 0, {}};
+
+        u8 cancelled = 0;
+        deadline_t deadline(cancelled, 0.2);
+        pl::time_budget budget(deadline);
+        nested::context ctx(map, nested::move_kind::raw, deadline, budget);
+
+        auto res = nested::nmcs(ctx, initial, 1);
+        assert(res.state.prog == read_program("R"));
+        assert(res.line.size() == 1);
+        assert(runsim(map, sim, res.state.prog, runsim_opts::no_abort).score == res.state.sim.score);
+    }
+}
+
+
+void static
+test_beam() {
+    {
+        auto m = read_map("########\n#R  \\ L#\n########");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        pl::search_state initial = {sim, 0, {}};
+
+        u8 cancelled = 0;
+        deadline_t deadline(cancelled, 0.2);
+        pl::time_budget budget(deadline);
+        auto state = pl::player_beam(map, initial, deadline, budget);
+        assert(state.sim.score == 70);
+        assert(runsim(map, sim, state.prog, runsim_opts::no_abort).score == state.sim.score);
+    }
+    {
+        ifstream si(MAPS_DIR "/sample/contest1.map");
+        auto m = read_map(si);
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        pl::search_state initial = {sim, 0, {}};
+
+        u8 cancelled = 0;
+        deadline_t deadline(cancelled, 0.3);
+        pl::time_budget budget(deadline);
+        auto state = pl::player_beam(map, initial, deadline, budget);
+        assert(state.sim.score > 0);
+        assert(runsim(map, sim, state.prog, runsim_opts::no_abort).score == state.sim.score);
+    }
+}
+
+
+void
+test_moves_commute() {
+    {
+        auto m = read_map("#######\n#     #\n#  R  #\n#    .#\n#*    #\n###L###");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+        assert(moves_commute(map, sim, action::right, action::up));
+        assert(!moves_commute(map, sim, action::right, action::left));
+        assert(!moves_commute(map, sim, action::left, action::down));
+        assert(!is_canonical(map, sim, action::up, action::right));
+        assert(is_canonical(map, sim, action::right, action::up));
+    }
+
+    mt19937 rng(0);
+
+    for_each_spec_walk(rng, 200, [] (const map_info& map, const sim_state& state) {
+        for (auto a : all_actions) {
+            for (auto b : all_actions) {
+                if (moves_commute(map, state, a, b)) {
+                    auto ab = simulator_step(map, simulator_step(map, state, a), b);
+                    auto ba = simulator_step(map, simulator_step(map, state, b), a);
+                    assert(ab.board == ba.board);
+                    assert(ab.score == ba.score);
+                    assert(ab.is_ended == ba.is_ended);
+                }
+            }
+        }
+    });
+}
+
+
+void static
+test_danger_map() {
+    {
+        auto m = read_map("#####\n#.*.#\n#.R.#\n#. .#\n#####");
+        auto& map = getmap(m);
+        auto& sim = getsim(m);
+
+        auto danger = danger_map(map, sim);
+        assert(is_lethal_step(map, sim, danger, action::down));
+        assert(!is_lethal_step(map, sim, danger, action::left));
+        assert(!is_lethal_step(map, sim, danger, action::right));
+        assert(simulator_step(map, sim, action::down).is_ended);
+
+        auto moves = legal_moves(map, sim, {}, {}, 0, 1);
+        assert(find(begin(moves), end(moves), action::down) == end(moves));
+        assert(find(begin(moves), end(moves), action::left) != end(moves));
+    }
+
+    mt19937 rng(7);
+
+    for_each_spec_walk(rng, 200, [] (const map_info& map, const sim_state& state) {
+        auto danger = danger_map(map, state);
+
+        for (auto mv : legal_moves(map, state, {})) {
+            if (is_lethal_step(map, state, danger, mv)) {
+                auto next = simulator_step(map, state, mv);
+                assert(next.is_ended && next.robot_pos != map.lift_pos);
+            }
+        }
+    });
+}
+
+
+string static
+_temp_path() {
+    char path[] = "/tmp/paiv-test-XXXXXX";
+    auto fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    return path;
+}
+
+
+string static
+_read_file(const string& path) {
+    ifstream si(path);
+    stringstream so;
+    so << si.rdbuf();
+    return so.str();
+}
+
+
+void static
+test_checkpoint() {
+    auto path = _temp_path();
+
+    checkpoint_t cp;
+    cp.path = path;
+
+    auto wait_interval = [&] () {
+        cp.flushed -= chrono::duration_cast<appclock::duration>(chrono::duration<r64>(checkpoint_interval));
+    };
+
+    auto check_file = [&] (const s32 score, const string& prog) {
+        stringstream si(_read_file(path));
+        r64 elapsed = -1;
+        s32 saved = s32_min;
+        string moves;
+        string rest;
+        si >> elapsed >> saved >> moves;
+        assert(elapsed >= 0);
+        assert(saved == score);
+        assert(moves == prog);
+        assert(!(si >> rest));
+    };
+
+    cp.offer(read_program("RR"), 10);
+    check_file(10, "RR");
+
+    wait_interval();
+    cp.offer(read_program("RRD"), 20);
+    check_file(20, "RRD");
+
+    wait_interval();
+    cp.offer(read_program("L"), 15);
+    assert(cp.best_score == 20);
+    check_file(20, "RRD");
+
+    remove(path.c_str());
+}
+
+
+void
+test_regions() {
+    auto m = read_map("###########\n#R.\\.#.\\..#\n#....#....#\n#.\\.......#\n#....#..\\.#\n#########L#");
+    auto& map = getmap(m);
+    auto& sim = getsim(m);
+
+    auto rmap = regions::analyse(map, sim);
+    assert(rmap.regions.size() == 2);
+    assert(rmap.id[3 * map.width + 5] == regions::no_region);
+
+    for (auto& r : rmap.regions) {
+        assert(r.independent);
+        assert(r.lambdas == 2);
+        assert(r.doors.size() == 1);
+    }
+
+    u8 cancelled = 0;
+    deadline_t deadline(cancelled, 0.5);
+    pl::time_budget budget(deadline);
+    pl::search_state initial = {sim, 0, {}};
+
+    // rooms are solved from made-up starts, none of their programs may reach the checkpoint
+    checkpoint.path = _temp_path();
+    auto plans = regions::solve_regions(map, initial, rmap, deadline.slice(0.2), budget);
+    assert(plans.size() == 2);
+    assert(checkpoint.best_score == s32_min);
+
+    {
+        checkpoint_mute mute;
+        checkpoint.offer(read_program("DD"), 1);
+        assert(checkpoint.best_score == s32_min);
+    }
+    assert(_read_file(checkpoint.path).empty());
+
+    remove(checkpoint.path.c_str());
+    checkpoint.path.clear();
+    checkpoint.best_score = s32_min;
+
+    auto state = regions::stitch(map, initial, plans, deadline, budget);
+    assert(state.is_win);
+    assert(runsim(map, sim, state.prog).score == state.sim.score);
+}
+
+
+void static
+test_tour() {
+    auto m = read_map("#########\n#\\.R..\\.#\n#.#####.#\n#\\.....\\L\n#########");
+    auto& map = getmap(m);
+    auto& sim = getsim(m);
+
+    u8 cancelled = 0;
+    deadline_t deadline(cancelled, 0.5);
+
+    auto order = pl::plan_tour(map, sim, deadline);
+    assert(order.size() == 4);
+    assert(manhattan_distance(order.back(), map.lift_pos) == 1);
+
+    pl::time_budget budget(deadline);
+    pl::search_state initial = {sim, 0, {}};
+
+    auto state = pl::follow_tour(map, initial, order, deadline, budget);
+    assert(state.is_win);
+    assert(state.sim.lambdas_collected == 4);
+    assert(runsim(map, sim, state.prog).score == state.sim.score);
+}
+
+
+void
+test_uct_tree() {
+    typedef uct_tree<u32> tree_t;
+    tree_t tree(10 * tree_t::node_bytes);
+
+    auto root = tree.add(no_node, 100, 0);
+    auto a = tree.add(root, 101, 1);
+    auto b = tree.add(root, 102, 2);
+    auto c = tree.add(a, 103, 3);
+
+    assert(tree.first_child[root] == a);
+    assert(tree.next_sibling[a] == b);
+    assert(tree.next_sibling[b] == no_node);
+    assert(tree.parent[c] == a);
+    assert(tree.visited[103] == c);
+
+    tree.backprop(c, 10);
+    tree.backprop(b, 20);
+    assert(tree.visits[root] == 2 && tree.mean[root] == 15);
+    assert(tree.visits[a] == 1 && tree.mean[a] == 10);
+
+    for (u32 i = 0; tree.size() < tree.capacity(); i++) {
+        auto id = tree.add(c, 200 + i, 0);
+        assert(id != no_node);
+    }
+    auto full = tree.add(c, 300, 0);
+    assert(full == no_node);
+
+    // a has fewer visits than the root, its subtree goes and a is left to be expanded again
+    tree.expanded[a] = 1;
+    tree.collect(root);
+    assert(tree.size() == 3);
+    assert(tree.first_child[a] == no_node && !tree.expanded[a]);
+    assert(tree.visits[a] == 1);
+    assert(tree.visited.count(103) == 0);
+
+    auto d = tree.add(b, 104, 4);
+    assert(d != no_node && d != root && d != a && d != b);
+    assert(tree.payload[d] == 4 && tree.visits[d] == 0);
+}
+
+
+void
+test_player_mc() {
+    const string mapfile = MAPS_DIR "/sample/contest3.map";
+    ifstream si(mapfile);
+    auto m = read_map(si);
+    auto& map = getmap(m);
+    auto& sim = getsim(m);
+
+    u8 cancelled = 0;
+    deadline_t deadline(cancelled, 0.5);
+    pl::time_budget budget(deadline);
+    pl::search_state initial = {sim, 0, {}};
+
+    // a pool of a few dozen nodes fills up early and has to be collected to keep expanding
+    auto state = pl::player_mc(map, initial, deadline, budget, 40 * pl::mc_tree::node_bytes);
+    assert(state.sim.score > 0);
+    assert(runsim(map, sim, state.prog, runsim_opts::no_abort).score == state.sim.score);
+}
+
+
+r64 static
+_timed_solve(const string& mapfile, const r64 timelimit, const u8& cancelled, s32* score) {
+    stringstream so;
+    ifstream si(mapfile);
+    auto started = appclock::now();
+
+    solve(si, so, timelimit, cancelled);
+
+    chrono::duration<r64> elapsed = appclock::now() - started;
+
+    ifstream mi(mapfile);
+    auto m = read_map(mi);
+    *score = runsim(getmap(m), getsim(m), read_program(so)).score;
+
+    return elapsed.count();
+}
+
+
+void
+test_deadline() {
+    static constexpr r64 slack = 0.02;
+    const string mapfile = MAPS_DIR "/sample/contest10.map";
+
+    {
+        u8 cancelled = 0;
+        s32 score = s32_min;
+        auto elapsed = _timed_solve(mapfile, 0.2, cancelled, &score);
+        assert(elapsed < 0.2 + slack);
+        assert(score >= 0);
+    }
+
+    {
+        static u8 cancelled = 0;
+        signal(SIGALRM, [](int){ cancelled = 1; });
+        ualarm(200000, 0);
+
+        s32 score = s32_min;
+        auto elapsed = _timed_solve(mapfile, 10, cancelled, &score);
+        assert(cancelled);
+        assert(elapsed < 0.2 + slack);
+        assert(score >= 0);
+    }
+}
+
+
 int
 test() {
     test_map_reader();
     test_program_reader();
     test_sim_step();
     test_sim();
+    test_make_unmake();
+    test_find_path_ida();
+    test_find_path_static();
+    test_reach();
+    test_score_bound();
+    test_post_optimizer();
+    test_time_budget();
+    test_genetic();
+    test_nested();
+    test_beam();
+    test_legal_mask();
+    test_alloc();
+    test_fixed_board();
+    test_uct_tree();
+    test_player_mc();
+    test_moves_commute();
+    test_goal_set();
+    test_goal_scan();
+    bench_goal_scan();
+    test_danger_map();
+    test_checkpoint();
+    test_regions();
+    test_tour();
+    test_deadline();
     return 0;
 }
 